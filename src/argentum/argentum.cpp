@@ -6,8 +6,8 @@ Stepper a_motor(STEPPER_A_STEP_PIN, STEPPER_A_DIR_PIN, STEPPER_A_ENABLE_PIN);
 // Should be y axis
 Stepper b_motor(STEPPER_B_STEP_PIN, STEPPER_B_DIR_PIN, STEPPER_B_ENABLE_PIN);
 
-Axis x_axis(Axis::X, &a_motor, &limit_x_positive, &limit_x_negative);
-Axis y_axis(Axis::Y, &b_motor, &limit_y_positive, &limit_y_negative);
+Axis x_axis(Axis::X, &a_motor, X_POS_BIT, X_NEG_BIT);
+Axis y_axis(Axis::Y, &b_motor, Y_POS_BIT, Y_NEG_BIT);
 
 SerialCommand serial_command;
 
@@ -4,6 +4,7 @@
 #include "../util/settings.h"
 #include "../util/axis.h"
 #include "../util/stepper.h"
+#include "../util/motion.h"
 #include "../util/logging.h"
 #include "../util/utils.h"
 
@@ -53,11 +54,15 @@ bool resolve(Stepper *motor,
         motor->set_direction(Stepper::CW);
     }
 
-    for(long step = 0; step < steps; step++) {
+    // Stop as soon as a switch changes, the rest of the distance tells us
+    // nothing more
+    uint8_t after = before;
+
+    for(long step = 0; step < steps && after == before; step++) {
         while(!motor->step());
-    }
 
-    uint8_t after = limit_switches();
+        after = limit_switches();
+    }
 
     uint8_t released = (before & ~after);
     uint8_t triggered = (after & ~before);
@@ -183,9 +188,112 @@ bool freedom(bool *x_direction_resolved, bool *y_direction_resolved) {
     return (a_resolved | b_resolved);
 }
 
-void calibrate(CalibrationData *calibration) {
+/**
+ * Run both axes toward their negative limits until each has triggered.
+ *
+ * The motion engine abandons a line as soon as either axis hits a limit, so
+ * an axis that is still free gets a new line when the first one stops. Each
+ * free axis is assumed to be up to distance steps away from its limit.
+ */
+static bool seek_negative(uint32_t distance) {
+    bool x_found = limit_x_negative();
+    bool y_found = limit_y_negative();
+
+    for(uint8_t line = 0; line < 2 && !(x_found && y_found); line++) {
+        x_axis.set_position(x_found ? 0 : distance);
+        y_axis.set_position(y_found ? 0 : distance);
+
+        motion_move_to(0, 0);
+
+        while(motion_moving());
+
+        // Stopping on a limit is expected here, don't report it
+        x_axis.limit_hit();
+        y_axis.limit_hit();
+
+        x_found = limit_x_negative();
+        y_found = limit_y_negative();
+    }
+
+    return (x_found && y_found);
+}
+
+// Run both axes from home toward their positive limits until each has
+// triggered.
+static bool seek_positive(void) {
+    uint32_t end = x_axis.constrain_position(Axis::PositiveLimit);
+
+    bool x_found = limit_x_positive();
+    bool y_found = limit_y_positive();
+
+    for(uint8_t line = 0; line < 2 && !(x_found && y_found); line++) {
+        motion_move_to(x_found ? x_axis.get_current_position() : end,
+                       y_found ? y_axis.get_current_position() : end);
+
+        while(motion_moving());
+
+        x_axis.limit_hit();
+        y_axis.limit_hit();
+
+        x_found = limit_x_positive();
+        y_found = limit_y_positive();
+    }
+
+    return (x_found && y_found);
+}
+
+bool home(void) {
+    unsigned long start = millis();
+
+    int x_speed = x_axis.get_motor()->get_speed();
+    int y_speed = y_axis.get_motor()->get_speed();
+
+    uint32_t backoff = Axis::um_to_steps(homing_backoff_um);
+
+    x_axis.set_speed(homing_seek_speed);
+    y_axis.set_speed(homing_seek_speed);
+
+    // The furthest either axis can be from its limit
+    bool found = seek_negative(x_axis.constrain_position(Axis::PositiveLimit));
+
+    if(found) {
+        // Back off both axes, then touch again slowly
+        x_axis.zero();
+        y_axis.zero();
+
+        motion_move_to(backoff, backoff);
+        motion_wait();
+
+        x_axis.set_speed(homing_touch_speed);
+        y_axis.set_speed(homing_touch_speed);
+
+        found = seek_negative(backoff * 2);
+    }
+
+    x_axis.set_speed(x_speed);
+    y_axis.set_speed(y_speed);
+
+    x_axis.zero();
+    y_axis.zero();
+
+    if(!found) {
+        logger.error() << "Homing failed, limits X-: " << limit_x_negative()
+                << " Y-: " << limit_y_negative() << Comms::endl;
+        return false;
+    }
+
+    logger.info() << "Homed in " << (millis() - start) << " ms"
+            << Comms::endl;
+
+    return true;
+}
+
+bool calibrate(CalibrationData *calibration) {
     logger.info("Calibration beginning.");
 
+    unsigned long start = millis();
+    unsigned long phase_start = start;
+
     x_axis.debug_info();
     y_axis.debug_info();
 
@@ -265,33 +373,60 @@ void calibrate(CalibrationData *calibration) {
     x_axis.debug_info();
     y_axis.debug_info();
 
+    logger.info() << "Resolved axes in " << (millis() - phase_start) << " ms"
+            << Comms::endl;
+
+    // Both axes are measured together, with a fast seek and a slow touch at
+    // each end
     logger.info("Homing");
 
-    x_axis.move_to_negative();
-    logger.info("x-");
-    y_axis.move_to_negative();
-    logger.info("y-");
+    if(!home()) {
+        return false;
+    }
+
+    phase_start = millis();
 
-    x_axis.zero();
-    y_axis.zero();
+    uint32_t backoff = Axis::um_to_steps(homing_backoff_um);
 
-    // Go to maximum extents
-    x_axis.move_to_positive();
-    logger.info("x+");
-    y_axis.move_to_positive();
-    logger.info("y+");
+    x_axis.set_speed(homing_seek_speed);
+    y_axis.set_speed(homing_seek_speed);
 
-    x_distance = x_axis.current_position;
-    y_distance = y_axis.current_position;
+    bool found = seek_positive();
+
+    if(found) {
+        motion_move_to(x_axis.get_current_position() - backoff,
+                       y_axis.get_current_position() - backoff);
+        motion_wait();
+
+        x_axis.set_speed(homing_touch_speed);
+        y_axis.set_speed(homing_touch_speed);
+
+        found = seek_positive();
+    }
+
+    x_axis.set_speed(1500);
+    y_axis.set_speed(1500);
+
+    if(!found) {
+        logger.error() << "Positive limits not found, X+: "
+                << limit_x_positive() << " Y+: " << limit_y_positive()
+                << Comms::endl;
+        return false;
+    }
+
+    x_distance = x_axis.get_current_position();
+    y_distance = y_axis.get_current_position();
+
+    logger.info() << "Measured axes in " << (millis() - phase_start) << " ms"
+            << Comms::endl;
 
     // Return to home
-    x_axis.move_to_negative();
-    logger.info("x-");
-    y_axis.move_to_negative();
-    logger.info("y-");
+    if(!home()) {
+        return false;
+    }
 
-    x_axis.zero();
-    y_axis.zero();
+    logger.info() << "Calibrated in " << (millis() - start) << " ms"
+            << Comms::endl;
 
     // Why doesn't this work?
     //x_axis.current_position = 100000;
@@ -306,4 +441,6 @@ void calibrate(CalibrationData *calibration) {
         calibration->y_axis.flipped = (y_axis.get_motor_mapping() != Axis::CW_Positive);
         calibration->y_axis.length = y_distance;
     }
+
+    return true;
 }
@@ -6,6 +6,16 @@
 const static int a_escape_steps = 400;
 const static int b_escape_steps = 400;
 
-void calibrate(CalibrationData *calibration);
+// Homing seeks both negative limits at once at the seek speed, backs off and
+// touches them again slowly. Speeds are in mm/min.
+const static int homing_seek_speed = 3000;
+const static int homing_touch_speed = 300;
+const static uint32_t homing_backoff_um = 2000;
+
+// Returns false, leaving calibration untouched, if a limit could not be found.
+bool calibrate(CalibrationData *calibration);
+
+// Returns false if either limit could not be found.
+bool home(void);
 
 #endif
@@ -1,5 +1,7 @@
 #include "commands.h"
 
+#include <stdio.h>
+
 //#include "AccelStepper.h"
 #include "../util/SerialCommand.h"
 #include "../util/settings.h"
@@ -14,11 +16,13 @@
 #include "../util/comms.h"
 
 #include "../util/axis.h"
+#include "../util/motion.h"
 
 #include "../util/logging.h"
 extern "C" {
 #include "../util/md5.h"
 #include "../util/decb.h"
+#include "../util/job.h"
 }
 
 #include "boardtests.h"
@@ -27,7 +31,11 @@ extern "C" {
 
 static char sd_initialized = 0;
 
-extern bool readFile(char *filename);
+extern bool readFile(char *filename, uint8_t pass, uint8_t passes,
+                     CheckpointData *resume, JobWriter *record);
+extern bool analyseFile(char *filename);
+extern bool indexFile(char *filename);
+extern bool indexFind(char *filename, uint16_t row, CheckpointData *found);
 extern void file_stats(char *filename);
 void moveTo(long x, long y);
 
@@ -75,9 +83,25 @@ void write_setting_command(void) {
             arg = serial_command.next();
             global_settings.processingOptions.print_overlap = atoi(arg);
         }
+        else if (!strcmp(arg, "mo"))
+        {
+            arg = serial_command.next();
+            if (arg)
+                global_settings.motionOptions.acceleration = atoi(arg);
+        }
+        else if (!strcmp(arg, "co"))
+        {
+            arg = serial_command.next();
+            if (arg)
+                global_settings.cartridgeOptions.address_hold = atoi(arg);
+            arg = serial_command.next();
+            if (arg)
+                global_settings.cartridgeOptions.pulse_width = atoi(arg);
+        }
     }
 
     settings_write_settings(&global_settings);
+    cartridge_configure(&global_settings.cartridgeOptions);
 }
 
 void speed_command(void) {
@@ -121,21 +145,57 @@ void zero_position_command(void) {
 void goto_zero_command(void) {
     logger.info("Returning to 0.000, 0.000");
 
-    x_axis.move_absolute(0.000);
-    y_axis.move_absolute(0.000);
+    x_axis.move_absolute_um(0);
+    y_axis.move_absolute_um(0);
 }
 
 void home_command(void) {
-    x_axis.move_to_negative();
-    y_axis.move_to_negative();
-    x_axis.zero();
-    y_axis.zero();
-    logger.info("Homed");
+    home();
+}
+
+// Micrometres written out as millimetres to three decimal places.
+static const char *format_mm(uint32_t um, char *buffer) {
+    sprintf(buffer, "%lu.%03u", um / 1000, (unsigned int)(um % 1000));
+
+    return buffer;
+}
+
+// Millimetres with up to three decimal places, as whole micrometres. Any
+// further places are ignored.
+static int32_t parse_um(const char *arg) {
+    bool negative = (*arg == '-');
+
+    if(*arg == '-' || *arg == '+') {
+        arg++;
+    }
+
+    int32_t um = 0;
+
+    while(isdigit(*arg)) {
+        um = um * 10 + (*arg++ - '0');
+    }
+
+    um *= 1000;
+
+    if(*arg == '.') {
+        arg++;
+
+        for(int32_t place = 100; place > 0 && isdigit(*arg); place /= 10) {
+            um += (*arg++ - '0') * place;
+        }
+    }
+
+    return negative ? -um : um;
 }
 
 void current_position_command(void) {
-    logger.info() << "X: " << x_axis.get_current_position_mm() << " mm, "
-            << "Y: " << y_axis.get_current_position_mm() << " mm"
+    char x_mm[16];
+    char y_mm[16];
+
+    logger.info() << "X: " << format_mm(x_axis.get_current_position_um(), x_mm)
+            << " mm, "
+            << "Y: " << format_mm(y_axis.get_current_position_um(), y_mm)
+            << " mm"
             << Comms::endl;
     logger.info() << "X: " << x_axis.get_current_position() << " steps, "
             << "Y: " << y_axis.get_current_position() << " steps"
@@ -211,6 +271,39 @@ void continuous_move(void) {
     logger.warn("Not implemented.");
 }
 
+// While the first pass of a print is recorded for the passes after it,
+// everything it queues is also compiled into a job. A dry run only records.
+static JobWriter *recorder = NULL;
+static bool recording_lost = false;
+static bool dry_run = false;
+
+void print_record(JobWriter *writer, bool dry) {
+    // The header is only complete once the last firings are written out
+    if(recorder) {
+        job_writer_flush(recorder);
+    }
+
+    recorder = writer;
+    dry_run = writer && dry;
+
+    if(writer) {
+        recording_lost = false;
+    }
+}
+
+void print_record_lost(void) {
+    recording_lost = true;
+}
+
+bool print_record_complete(void) {
+    return !recording_lost;
+}
+
+bool print_dry_run(void) {
+    return dry_run;
+}
+
+// Queues the move and returns, use motion_wait() to wait for it to finish.
 void move(const char axis_id, long steps) {
     //Stepper *motor = motor_from_axis(axis);
     Axis *axis = axis_from_id(axis_id);
@@ -221,31 +314,27 @@ void move(const char axis_id, long steps) {
         return;
     }
 
+    if(recorder) {
+        job_write_move(recorder, axis_id, steps);
+    }
+
+    if(dry_run) {
+        return;
+    }
+
     //logger.info() << "Moving " << axis << " axis " << steps << "steps" << Comms::endl;
 
     if(steps == 0) {
-        //motor->reset_position();
-        //axis->move_absolute(0.000);
-
-        axis->move_incremental(-(int32_t)axis->get_current_position());
+        axis->move_absolute((uint32_t)0);
     } else {
         axis->move_incremental(steps);
     }
-
-    axis->wait_for_move();
 }
 
 void moveTo(long x, long y)
 {
-    x_axis.move_absolute((uint32_t)x);
-    y_axis.move_absolute((uint32_t)y);
-    while (x_axis.moving() || y_axis.moving())
-    {
-        if (x_axis.moving())
-            x_axis.run();
-        if (y_axis.moving())
-            y_axis.run();
-    }
+    motion_move_to((uint32_t)x, (uint32_t)y);
+    motion_wait();
 }
 
 void power_command(void) {
@@ -325,6 +414,7 @@ char hexdig(char ch)
     return 0;
 }
 
+// Fire once the carriage reaches the end of the queued moves.
 void fire_spec(char *spec)
 {
     byte a, f1, f2;
@@ -332,7 +422,33 @@ void fire_spec(char *spec)
     a = hexdig(spec[0]);
     f1 = (hexdig(spec[1]) << 4) | hexdig(spec[2]);
     f2 = (hexdig(spec[3]) << 4) | hexdig(spec[4]);
-    fire_head(f1, a, f2, a);
+
+    // Nothing would be energised, don't take up a place in the queue
+    if (!f1 && !f2)
+        return;
+
+    fire_single(f1, a, f2, a);
+}
+
+// Fire once the carriage reaches the end of the queued moves.
+void fire_single(byte r_prim, byte r_addr, byte l_prim, byte l_addr)
+{
+    if (recorder)
+        job_write_firing(recorder, r_prim, r_addr, l_prim, l_addr);
+
+    if (!dry_run)
+        motion_fire(r_prim, r_addr, l_prim, l_addr);
+}
+
+// Fire each address of a binary column frame, without the FIRING_COLUMN byte,
+// once the carriage reaches the end of the queued moves.
+void fire_frame(const byte *frame)
+{
+    if (recorder)
+        job_write_column(recorder, frame);
+
+    if (!dry_run)
+        motion_fire_column(frame);
 }
 
 void fire_command(void) {
@@ -379,20 +495,132 @@ void draw_command(void) {
         return;
     }
 
+    byte a = hexdig(spec[0]);
+    byte f1 = (hexdig(spec[1]) << 4) | hexdig(spec[2]);
+    byte f2 = (hexdig(spec[3]) << 4) | hexdig(spec[4]);
+
+    // The firings are attached to this move, so it has to be the last one
+    // queued. It is held until they are all in, so none of their steps can
+    // be passed first.
+    uint32_t start = axis->get_desired_position();
+
+    motion_hold();
     axis->move_incremental(steps);
 
+    uint32_t end = axis->get_desired_position();
+    uint16_t length = (end > start) ? (end - start) : (start - end);
+
     logger.info() << "Firing " << spec << " at rate " << rate << Comms::endl;
 
+    // Schedule the firings by step, the motion interrupt fires them as the
+    // carriage passes
     float acc = 0;
-    while(axis->moving()) {
-        if (axis->run()) {
-            acc += rate;
-            while (acc >= 1.0) {
-                fire_spec(spec);
-                acc -= 1.0;
+    for(uint16_t step = 1; step <= length; step++) {
+        acc += rate;
+        while (acc >= 1.0) {
+            motion_fire_at(step, f1, a, f2, a);
+            acc -= 1.0;
+        }
+    }
+
+    motion_release();
+
+    motion_wait();
+}
+
+// Later passes of a text or compressed print replay this, compiled from what
+// the first pass queued.
+static char plan_filename[] = "PASSES.JOB";
+
+static void write_plan(void *context, const uint8_t *data, uint16_t length) {
+    ((SdFile *)context)->write(data, length);
+}
+
+// Only keeps the plan if every command in the first pass went in to it.
+static bool finish_plan(SdFile *plan, JobWriter *writer) {
+    JobHeader *header = &writer->header;
+
+    if(recording_lost || plan->getWriteError() ||
+            header->move_count + header->firing_count == 0) {
+        plan->remove();
+        return false;
+    }
+
+    plan->seekSet(0);
+    plan->write(header, sizeof(JobHeader));
+
+    return plan->close();
+}
+
+// Runs the remaining passes of a print, the first from the checkpoint if one is
+// given. The checkpoint is only cleared once the last pass is done.
+static void print_passes(char *filename, uint8_t pass, uint8_t passes,
+                         CheckpointData *resume) {
+    SdFile plan;
+    JobWriter writer;
+    bool recording = false;
+
+    // Only a whole first pass can be replayed
+    if(pass == 0 && passes > 1 && !resume &&
+            strcasecmp(filename, plan_filename) != 0) {
+        recording = plan.open(plan_filename, O_CREAT | O_WRITE | O_TRUNC);
+
+        if(recording) {
+            job_writer_init(&writer, write_plan, &plan);
+        }
+    }
+
+    // Progress saved by an earlier print of the same file doesn't carry over
+    if(!resume) {
+        settings_clear_checkpoint();
+    }
+
+    for(; pass < passes; pass++) {
+        logger.info() << "Pass " << (pass + 1) << " of " << passes << Comms::endl;
+
+        bool result = readFile(filename, pass, passes, resume,
+                               recording ? &writer : NULL);
+
+        resume = NULL;
+
+        if(recording) {
+            recording = false;
+
+            if(!result) {
+                plan.remove();
+            } else if(finish_plan(&plan, &writer)) {
+                logger.info("Replaying the first pass for the rest");
+                filename = plan_filename;
             }
         }
+
+        if(!result) {
+            logger.info("Print did not finish, resume carries on from the last checkpoint");
+            return;
+        }
+
+        if(0) {
+            long x_delta = 6500 + x_size;
+
+            logger.info() << "x_delta: " << x_delta << Comms::endl;
+            logger.info() << -6500 - x_size << Comms::endl;
+
+            move('X', -6500 - x_size);
+            move('Y', -500);
+
+            // TODO: Should get these params from the readFile (or print) function
+            // Perhaps passing in some kind of printinfo struct containing print
+            // statistics after it's done.
+            sweep(x_size + 2000, y_size + 1000);
+
+            move('X', x_delta);
+            move('Y', 500);
+        }
     }
+
+    settings_clear_checkpoint();
+
+    logger.info("Print complete. Enjoy your circuit!");
 }
 
 void print_command(void) {
@@ -418,36 +646,91 @@ void print_command(void) {
         passes = atoi(arg);
     }
 
+    arg = serial_command.next();
+
+    if(arg) {
+        // Start the first pass from a row, found through the file's index
+        static CheckpointData start;
+
+        if(!indexFind(filename, atol(arg), &start)) {
+            return;
+        }
+
+        logger.info() << "Printing '" << filename << "' from row " << arg
+                << Comms::endl;
+
+        motion_move_to(x_axis.get_current_position() + start.x_position,
+                       y_axis.get_current_position() + start.y_position);
+        motion_wait();
+
+        start.x_position = x_axis.get_current_position();
+        start.y_position = y_axis.get_current_position();
+
+        print_passes(filename, 0, passes, &start);
+
+        return;
+    }
+
     logger.info() << "Printing '" << filename << "'" << Comms::endl;
 
-    for(int pass = 0; pass < passes; pass++) {
-        logger.info() << "Pass " << (pass + 1) << " of " << passes << Comms::endl;
+    print_passes(filename, 0, passes, NULL);
+}
 
-        bool result = readFile(filename);
+// Re-home, go back to where the last checkpoint was taken and carry on from
+// there. Prints are assumed to have started from the home position.
+void resume_print_command(void) {
+    static CheckpointData checkpoint;
 
-        if(0) {
-            long x_delta = 6500 + x_size;
+    if(!settings_read_checkpoint(&checkpoint)) {
+        logger.error("No print to resume");
+        return;
+    }
 
-            logger.info() << "x_delta: " << x_delta << Comms::endl;
-            logger.info() << -6500 - x_size << Comms::endl;
+    if (!sd_initialized)
+        init_sd_command();
 
-            move('X', -6500 - x_size);
-            move('Y', -500);
+    logger.info() << "Resuming '" << checkpoint.filename << "' pass "
+            << (checkpoint.pass + 1) << " of " << checkpoint.passes
+            << " from byte " << checkpoint.offset << Comms::endl;
 
-            // TODO: Should get these params from the readFile (or print) function
-            // Perhaps passing in some kind of printinfo struct containing print
-            // statistics after it's done.
-            sweep(x_size + 2000, y_size + 1000);
+    if(!home()) {
+        logger.error("Could not home, not resuming");
+        return;
+    }
 
-            move('X', x_delta);
-            move('Y', 500);
-        } else {
-            //logger.info("Something went wrong in readFile, aborting print.");
-            //return;
-        }
+    motion_move_to(checkpoint.x_position, checkpoint.y_position);
+    motion_wait();
+
+    print_passes(checkpoint.filename, checkpoint.pass, checkpoint.passes,
+                 &checkpoint);
+}
+
+void analyse_command(void) {
+    if (!sd_initialized)
+        init_sd_command();
+
+    char *arg = serial_command.next();
+
+    if(!arg) {
+        logger.error("Missing filename");
+        return;
     }
 
-    logger.info("Print complete. Enjoy your circuit!");
+    analyseFile(arg);
+}
+
+void index_command(void) {
+    if (!sd_initialized)
+        init_sd_command();
+
+    char *arg = serial_command.next();
+
+    if(!arg) {
+        logger.error("Missing filename");
+        return;
+    }
+
+    indexFile(arg);
 }
 
 void print_ram(void) {
@@ -590,11 +873,98 @@ void djb2_command(void) {
     Serial.println((char*)block);
 }
 
-int onlinePrint(byte *buf, int buflen)
+// A move of zero steps goes back to zero, as in move(). X moves print a dot so
+// the host can follow a print from file.
+void print_extents_move(PrintExtents *extents, char axis, long steps) {
+    if(axis == 'X') {
+        extents->cur_x += steps;
+
+        if(steps == 0) {
+            extents->cur_x = 0;
+        }
+
+        if(extents->cur_x > extents->max_x) {
+            extents->max_x = extents->cur_x;
+        }
+
+        if(!dry_run) {
+            Serial.println(".");
+        }
+    }
+
+    if(axis == 'Y') {
+        extents->cur_y += steps;
+
+        if(steps == 0) {
+            extents->cur_y = 0;
+        }
+
+        if(extents->cur_y > extents->max_y) {
+            extents->max_y = extents->cur_y;
+        }
+    }
+}
+
+// Print files only hold moves, firings and comments, so they are run here
+// rather than going through the serial command parser.
+bool print_line(char *line, PrintExtents *extents)
+{
+    JobLine parsed;
+
+    switch (job_parse_line(line, &parsed))
+    {
+    case JOB_LINE_NONE:
+        return true;
+
+    case JOB_LINE_FIRE:
+        // Nothing would be energised, don't take up a place in the queue
+        if (parsed.r_prim || parsed.l_prim)
+            fire_single(parsed.r_prim, parsed.r_addr, parsed.l_prim,
+                        parsed.l_addr);
+        return true;
+
+    case JOB_LINE_MOVE_TO:
+        // Followed for the estimate, but a move to isn't replayed
+        if (recorder)
+            job_write_move_to(recorder, parsed.x, parsed.y);
+
+        print_record_lost();
+
+        if (!dry_run)
+        {
+            moveTo(parsed.x, parsed.y);
+
+            if (*parsed.rest == 'k')
+                logger.info() << "Ok" << Comms::endl;
+        }
+        return true;
+
+    case JOB_LINE_MOVE:
+        move(parsed.axis, parsed.x);
+
+        if (extents)
+            print_extents_move(extents, parsed.axis, parsed.x);
+        return true;
+    }
+
+    return false;
+}
+
+int onlinePrint(byte *buf, int buflen, PrintExtents *extents)
 {
     byte *p = buf;
     while (p < buf + buflen)
     {
+        if (p[0] == FIRING_COLUMN)
+        {
+            if (buf + buflen - p < FIRING_COLUMN_SIZE)
+                break;
+
+            fire_frame(p + 1);
+            p += FIRING_COLUMN_SIZE;
+            continue;
+        }
+
         byte *pe = p;
         while (pe < buf + buflen && *pe != '\n')
             pe++;
@@ -602,21 +972,7 @@ int onlinePrint(byte *buf, int buflen)
             break;
 
         *pe = 0;
-        if (p[0] == '#')
-        {
-            // ignore comment
-        }
-        else if (p[0] == 'M')
-        {
-            char axis = p[2];
-
-            long steps = atol((char*)p + 4);
-            move(axis, steps);
-        }
-        else if (p[0] == 'F')
-        {
-            fire_spec((char*)p+2);
-        }
+        print_line((char*)p, extents);
 
         p = pe + 1;
     }
@@ -624,7 +980,17 @@ int onlinePrint(byte *buf, int buflen)
     return buf + buflen - p;
 }
 
-void recv_command(void) {
+// .b is the extension decb expects for compressed files.
+bool compressed_filename(const char *filename) {
+    uint8_t length = strlen(filename);
+
+    return length > 2 && filename[length - 2] == '.' &&
+            (filename[length - 1] == 'b' || filename[length - 1] == 'B');
+}
+
+// Receives an upload, returning the name it was stored under once it has all
+// been written, or NULL.
+static char *recv_file(void) {
     char *arg = serial_command.next();
     uint32_t size = 0;
     while (*arg >= '0' && *arg <= '9')
@@ -638,8 +1004,10 @@ void recv_command(void) {
         init_sd_command();
     if (!strcmp(filename, "b") || !strcmp(filename, "bo"))
     {
-        compressed = true;
         filename = serial_command.next();
+
+        // A .b file is kept as it is and decoded as it prints
+        compressed = online || !filename || !compressed_filename(filename);
         decb_init();
     }
 
@@ -650,7 +1018,7 @@ void recv_command(void) {
         if (!file.isOpen()) {
             Serial.print("File could not be opened: ");
             Serial.println(filename);
-            return;
+            return NULL;
         }
     }
 
@@ -669,7 +1037,7 @@ void recv_command(void) {
         {
             // eep
             Serial.write((byte*)"J", 1);
-            return;
+            return NULL;
         }
         uint32_t nleft = size - pos;
         int blocksize = nleft < 1024 ? nleft : 1024;
@@ -688,7 +1056,7 @@ void recv_command(void) {
             {
                 if (!online)
                     file.remove();
-                return;
+                return NULL;
             }
             if (len == 1 && where == inoff && block[where] == 'P')
             {
@@ -715,7 +1083,7 @@ void recv_command(void) {
             Serial.println(pos);
             Serial.println(size);
             Serial.write(block + inoff, blocksize + 5 - nread);
-            return;
+            return NULL;
         }
 
         uint32_t oldhash = hash;
@@ -753,7 +1121,7 @@ void recv_command(void) {
                 {
                     // TODO: see if we can report bad block and unwind
                     Serial.write((byte*)"F", 1);
-                    return;
+                    return NULL;
                 }
                 if (online)
                 {
@@ -787,8 +1155,33 @@ void recv_command(void) {
         Serial.write((byte*)"G", 1);
     }
 
-    if (!online)
-        file.close();
+    if (compressed)
+    {
+        // Moves still held back over blank columns at the end of the data
+        int outlen = decb_finish((char*)block2 + outoff);
+        if (online)
+            onlinePrint(block2, outoff + outlen);
+        else
+            file.write(block2, outlen);
+    }
+
+    if (online || !file.close())
+        return NULL;
+
+    return filename;
+}
+
+void recv_command(void) {
+    char *filename = recv_file();
+    char name[32];
+
+    // Index what was stored, once the upload buffers are off the stack. The
+    // name is copied since the walk can take in more serial commands.
+    if (filename && strlen(filename) < sizeof(name))
+    {
+        strcpy(name, filename);
+        indexFile(name);
+    }
 }
 
 void echo_command(void) {
@@ -834,7 +1227,11 @@ void printer_number_command(void) {
 
 void calibrate_command(void) {
     CalibrationData calibration;
-    calibrate(&calibration);
+
+    if(!calibrate(&calibration)) {
+        logger.error("Calibration failed, settings not changed.");
+        return;
+    }
 
     settings_print_calibration(&calibration);
     settings_update_calibration(&calibration);
@@ -850,7 +1247,10 @@ void calibrate_loop_command(void) {
         }
 
         CalibrationData calibration;
-        calibrate(&calibration);
+
+        if(!calibrate(&calibration)) {
+            return;
+        }
 
         logger.info() << calibration.x_axis.motor << " "
                 << calibration.x_axis.length << ", " << calibration.x_axis.motor
@@ -1126,22 +1526,27 @@ void sweep(long width, long height) {
         logger.info() << "   Pass: " << pass + 1 << " of " << passes << Comms::endl;
 
         // 1. Lower rollers
+        motion_wait();
         rollers.deploy();
         delay(100);
 
         // 2. Make first x pass
         move('y', width);
+        motion_wait();
         rollers.retract();
 
         move('y', -width);
+        motion_wait();
         rollers.deploy();
 
         move('y', width);
+        motion_wait();
         rollers.retract();
 
         move('y', -width);
 
         // 3. Raise rollers
+        motion_wait();
         rollers.retract();
         delay(100);
 
@@ -1160,28 +1565,28 @@ void absolute_move(void) {
     arg = serial_command.next();
 
     if(arg == NULL) {
-        logger.error("Missing x position (double)");
+        logger.error("Missing x position (mm)");
         return;
     }
 
-    double x_position = atof(arg);
+    int32_t x_position = parse_um(arg);
 
     arg = serial_command.next();
 
     if(arg == NULL) {
-        logger.error("Missing y position (double)");
+        logger.error("Missing y position (mm)");
         return;
     }
 
-    double y_position = atof(arg);
+    int32_t y_position = parse_um(arg);
 
     if(x_position < 0 || y_position < 0) {
         logger.error("Absolute positions must be positive.");
         return;
     }
 
-    x_axis.move_absolute(x_position);
-    y_axis.move_absolute(y_position);
+    x_axis.move_absolute_um(x_position);
+    y_axis.move_absolute_um(y_position);
 }
 
 void incremental_move(void) {
@@ -1190,23 +1595,23 @@ void incremental_move(void) {
     arg = serial_command.next();
 
     if(arg == NULL) {
-        logger.error("Missing x position (double)");
+        logger.error("Missing x position (mm)");
         return;
     }
 
-    double x_position = atof(arg);
+    int32_t x_position = parse_um(arg);
 
     arg = serial_command.next();
 
     if(arg == NULL) {
-        logger.error("Missing y position (double)");
+        logger.error("Missing y position (mm)");
         return;
     }
 
-    double y_position = atof(arg);
+    int32_t y_position = parse_um(arg);
 
-    x_axis.move_incremental(x_position);
-    y_axis.move_incremental(y_position);
+    x_axis.move_incremental_um(x_position);
+    y_axis.move_incremental_um(y_position);
 }
 
 void plus_command(void) {
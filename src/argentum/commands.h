@@ -8,6 +8,10 @@
 #include "../util/axis.h"
 #include "../util/SdFat/SdFat.h"
 
+extern "C" {
+#include "../util/job.h"
+}
+
 void read_setting_command(void);
 void read_saved_setting_command(void);
 void write_setting_command(void);
@@ -53,6 +57,47 @@ void resume_command(void);
 void fire_command(void);
 void draw_command(void);
 void print_command(void);
+void resume_print_command(void);
+
+// Walks a file without moving or firing and reports its size and print time.
+void analyse_command(void);
+
+// Writes the .idx index of a file, so p can start a print from any row.
+void index_command(void);
+
+// Furthest position a print from file reaches, followed as moves are queued.
+struct PrintExtents {
+    long cur_x;
+    long cur_y;
+    long max_x;
+    long max_y;
+};
+
+void print_extents_move(PrintExtents *extents, char axis, long steps);
+
+// Runs decoded print data, moves, firing lines and column frames, out of a
+// buffer. Returns the number of bytes at the end that don't yet make up a
+// whole command.
+int onlinePrint(byte *buf, int buflen, PrintExtents *extents = NULL);
+
+// Runs one terminated line of print data: an M move, an F firing or a comment.
+// False if it is none of those.
+bool print_line(char *line, PrintExtents *extents = NULL);
+
+// Fire once the carriage reaches the end of the queued moves.
+void fire_single(byte r_prim, byte r_addr, byte l_prim, byte l_addr);
+
+// Moves and firings queued for a print are also compiled into the writer, if
+// there is one, so later passes can replay them. A print that runs anything
+// else has to call print_record_lost() so the recording isn't used. A dry run
+// compiles without moving or firing anything.
+void print_record(JobWriter *writer, bool dry = false);
+void print_record_lost(void);
+
+// False if anything run since the writer was given couldn't be compiled.
+bool print_record_complete(void);
+bool print_dry_run(void);
+
 void print_ram(void);
 
 void help_command(void);
@@ -68,6 +113,9 @@ void rm_command(void);
 void md5_command(void);
 void djb2_command(void);
 void recv_command(void);
+
+// True for names ending in .b, which are stored and printed compressed.
+bool compressed_filename(const char *filename);
 void echo_command(void);
 
 // GPIO
@@ -6,12 +6,20 @@
 #include "argentum/commands.h"
 #include "util/utils.h"
 #include "util/axis.h"
+#include "util/motion.h"
 #include "util/logging.h"
 #include "argentum/argentum.h"
 
 #include "argentum/boardtests.h"
 
 #include "util/SdFat/SdFat.h"
+#include "util/filereader.h"
+
+extern "C" {
+#include "util/decb.h"
+#include "util/job.h"
+#include "util/index.h"
+}
 
 SdFile myFile;
 
@@ -26,6 +34,8 @@ void setup() {
 
     rollers.disable();
 
+    motion_initialise();
+
     x_axis.set_speed(1500);
     y_axis.set_speed(1500);
 
@@ -33,6 +43,7 @@ void setup() {
 
     cartridge_initialise();
     analog_initialise();
+    primitive_voltage_start();
     limit_initialise();
     fet_initialise();
 
@@ -67,6 +78,9 @@ void setup() {
     serial_command.addCommand("p", &print_command);
     serial_command.addCommand("P", &pause_command);
     serial_command.addCommand("R", &resume_command);
+    serial_command.addCommand("resume", &resume_print_command);
+    serial_command.addCommand("analyse", &analyse_command);
+    serial_command.addCommand("index", &index_command);
     serial_command.addCommand("F", &fire_command);
     serial_command.addCommand("D", &draw_command);
 
@@ -153,8 +167,8 @@ static int white = 0;
 static long old_time = 0;
 static bool dir = false;
 
-// Note: This loop _should_ execute three times faster than the motors can step
-// at 5000 speed. Measured.
+// Stepping happens in the motion timer interrupt, the axes are only polled here
+// to report any limit switch holds.
 void loop() {
     x_axis.run();
     y_axis.run();
@@ -210,7 +224,7 @@ void parse_command(byte* command) {
 
     switch(command[0]) {
         case 0x01:
-            fire_head((byte)command[1], (byte)command[2], (byte)command[5], (byte)command[6]);
+            fire_single((byte)command[1], (byte)command[2], (byte)command[5], (byte)command[6]);
 
             break;
 
@@ -219,179 +233,778 @@ void parse_command(byte* command) {
     }
 }
 
-extern void fire_spec(char *spec);
+extern void fire_frame(const byte *frame);
 
-bool readFile(char *filename) {
-    byte command[20];
+// Handles anything received over serial during a print. An 'S' stops the
+// print and returns the carriage to zero. A dry run only looks for the 'S',
+// anything else is left to be run once the walk is done, as a command run
+// now would be compiled into the walk or reopen the file it is reading.
+static bool stop_requested(void) {
+    if(Serial.available()) {
+        if(Serial.peek() == 'S') {
+            //swap_motors();
 
-    //swap_motors();
+            Serial.println("Stopping.");
 
-    //xMotor->set_position(0L);
-    //yMotor->set_position(0L);
+            if(!print_dry_run()) {
+                motion_abort();
+                goto_zero_command();
+            }
 
-    //x_axis.zero();
-    //y_axis.zero();
+            return true;
+        }
 
-    // Open File
-    myFile.open(filename);
+        if(!print_dry_run()) {
+            serialEvent();
+        }
+    }
 
-    // Check if file open succeeded, if not output error message
-    if (!myFile.isOpen()) {
-        Serial.print("File could not be opened: ");
-        Serial.println(filename);
+    return false;
+}
 
-        return false;
+// The file being printed, read ahead while waiting on the motion queue.
+static FileReader *prefetch_reader = NULL;
+
+static void prefetch_sector(void) {
+    prefetch_reader->prefetch();
+}
+
+// Progress is saved this often, at the next point in the file where the
+// decoder state is known. The carriage has to stop for it.
+#define CHECKPOINT_INTERVAL 30000
+
+static CheckpointData checkpoint;
+static unsigned long checkpoint_time;
+
+// Everything before the reader's position has been queued, wait for it to run
+// so the checkpoint matches where the carriage really is.
+static void save_checkpoint(FileReader *reader, bool compressed) {
+    motion_wait();
+
+    checkpoint.offset = reader->position();
+    checkpoint.x_position = x_axis.get_current_position();
+    checkpoint.y_position = y_axis.get_current_position();
+
+    if(compressed) {
+        decb_save(&checkpoint.decoder);
     }
 
-    //Serial.println("Starting");
-    //Serial.println(start);
-    logger.info() << "readFile(" << filename << ")" << Comms::endl;
+    settings_write_checkpoint(&checkpoint);
+
+    checkpoint_time = millis();
+}
+
+// Set while a dry run is writing an index, which follows the position and
+// columns through the writer the walk is compiled into.
+static SdFile *index_file = NULL;
+static JobWriter *index_writer;
+static uint32_t index_count;
+static uint32_t index_offset;
+static uint16_t index_row;
+
+// Every move in X starts a new row, with an entry at the offset of the move
+// itself. Long rows get another entry every INDEX_INTERVAL bytes.
+static void index_due(FileReader *reader, bool compressed, bool row) {
+    JobHeader *header = &index_writer->header;
+    uint32_t offset = reader->position();
+
+    if(!row && index_count > 0 && offset - index_offset < INDEX_INTERVAL) {
+        return;
+    }
+
+    if(row) {
+        index_row++;
+    }
 
-    long start = micros();
-    long end = 0L;
-    long count = 0L;
+    IndexEntry entry;
 
-    /*uint8_t buffer[4096];
+    entry.offset = offset;
+    entry.column = header->firing_count;
+    entry.row = index_row;
+    entry.x_position = index_writer->cur_x;
+    entry.y_position = index_writer->cur_y;
 
-    while(myFile.available()) {
-        count++;
+    if(compressed) {
+        decb_save(&entry.decoder);
+    } else {
+        memset(&entry.decoder, 0, sizeof(DecbState));
+    }
+
+    index_file->write(&entry, sizeof(entry));
+
+    index_count++;
+    index_offset = offset;
+}
 
-        myFile.read(buffer, sizeof(buffer));
+// Called between commands, where the reader's position and the decoder state
+// cover exactly what has been queued. Row is set if the next command moves in
+// X.
+static inline void command_boundary(FileReader *reader, bool compressed,
+                                    bool row) {
+    if(print_dry_run()) {
+        if(index_file) {
+            index_due(reader, compressed, row);
+        }
+    } else if(millis() - checkpoint_time >= CHECKPOINT_INTERVAL) {
+        save_checkpoint(reader, compressed);
     }
+}
 
-    end = micros();
+// An M X line is next in a text file, or an X line in a compressed one. The
+// text check can refill the reader, so pointers from peek() go stale.
+static bool x_line_next(FileReader *reader, bool compressed) {
+    uint16_t count;
+    uint8_t *data;
 
-    count = count * sizeof(buffer);
+    if(compressed) {
+        data = reader->buffered(&count);
 
-    double time = end - start;
-    double average = time / count;
+        return count > 0 && data[0] == 'X';
+    }
 
-    Serial.println("Timing:");
-    Serial.println(start);
-    Serial.println(end);
-    Serial.println(time);
-    Serial.println(count);
-    Serial.println(average);*/
+    data = reader->peek(4);
 
-    // if file.available() fails then do something?
+    return data != NULL && data[0] == 'M' && data[1] == ' ' &&
+            toupper(data[2]) == 'X' && data[3] == ' ';
+}
 
-    colour(COLOUR_PRINTING);
+// Checksum everything after the header, before any of it is printed.
+static bool verify_job(FileReader *reader, const JobHeader *header) {
+    uint32_t checksum = JOB_CHECKSUM_START;
+    uint16_t skip = header->header_size;
+    uint16_t count;
+    uint8_t *data;
 
-    long max_x = 0;
-    long max_y = 0;
+    reader->rewind();
 
-    long cur_x = 0;
-    long cur_y = 0;
+    while((data = reader->read(&count)) != NULL) {
+        if(skip >= count) {
+            skip -= count;
+            continue;
+        }
 
-    // loop through file
-    while(myFile.available()) {
-        // read in first byte of command
-        command[0] = myFile.read();
+        checksum = job_checksum(checksum, data + skip, count - skip);
+        skip = 0;
+    }
 
-        //Serial.println(command[0]);
+    reader->rewind();
 
-        if(command[0] == 0x01) {
-            // read in extra bytes if necessary
-            switch(command[0]) {
-                case 1:
-                    for(int i = 0; i < 7; i++) {
-                        command[i + 1] = myFile.read();
-                    }
+    return checksum == header->checksum;
+}
 
-                    break;
-            }
+static void report_job(const JobHeader *header) {
+    logger.info() << "Job: " << header->x_extent << " x " << header->y_extent
+            << " steps, " << header->move_count << " moves, "
+            << header->firing_count << " columns" << Comms::endl;
 
-            parse_command(command);
-        } else if(command[0] == 'F') {
-            // Textual version of firing commands
-            int i = 1;
+    logger.info() << "Travel: " << header->x_travel << " x "
+            << header->y_travel << " steps" << Comms::endl;
+}
 
-            while(myFile.peek() != '\n' && i < 18) {
-                command[i] = myFile.read();
-                i++;
-            }
-            command[i] = 0x00;
+// Compiled jobs are already validated, so the records are executed as they
+// are read.
+static bool print_job(FileReader *reader) {
+    uint8_t *data;
 
-            fire_spec((char*)command + 2);
-        } else if(command[0] == 'M') {
-            // read in extra bytes if necessary
-            int i = 1;
+    while((data = reader->peek(1)) != NULL) {
+        command_boundary(reader, false, data[0] == JOB_MOVE_X);
 
-            while(myFile.peek() != '\n' && i < 18) {
-                command[i] = myFile.read();
-                i++;
-            }
-            command[i] = 0x00;
+        if(data[0] == JOB_MOVE_X || data[0] == JOB_MOVE_Y) {
+            data = reader->peek(JOB_MOVE_SIZE);
 
-            long steps = atol((const char *)&command[4]);
-            char axis = command[2];
+            if(data == NULL) {
+                break;
+            }
 
-            //logger.info() << "Movement command: " << axis << " " << steps << Comms::endl;
+            int16_t steps = data[1] | (data[2] << 8);
 
-            if(axis == 'X') {
-                cur_x += steps;
+            if(data[0] == JOB_MOVE_X) {
+                move('X', steps);
 
-                if(steps == 0) {
-                    cur_x = 0;
+                if(!print_dry_run()) {
+                    Serial.println(".");
                 }
+            } else {
+                move('Y', steps);
+            }
 
-                if(cur_x > max_x) {
-                    max_x = cur_x;
-                }
+            reader->consume(JOB_MOVE_SIZE);
+        } else if(data[0] == FIRING_COLUMN) {
+            data = reader->peek(FIRING_COLUMN_SIZE);
 
-                Serial.println(".");
+            if(data == NULL) {
+                break;
             }
 
-            if(axis == 'Y') {
-                cur_y += steps;
+            fire_frame(data + 1);
+            reader->consume(FIRING_COLUMN_SIZE);
+        } else {
+            logger.error() << "Bad job record " << data[0] << Comms::endl;
 
-                if(steps == 0) {
-                    cur_y = 0;
-                }
+            return false;
+        }
 
-                if(cur_y > max_y) {
-                    max_y = cur_y;
-                }
+        if(stop_requested()) {
+            return false;
+        }
+    }
 
-                //logger.info() << "steps: " << steps << " cur_y: " << cur_y
-                //        << " max_y: " << max_y << Comms::endl;
+    return true;
+}
+
+// Print files of M and F lines, or decb() output, tracking the furthest
+// position reached since that isn't known up front.
+static bool print_text(FileReader *reader, PrintExtents *extents) {
+    uint8_t *data;
+
+    // loop through file
+    while((data = reader->peek(1)) != NULL) {
+        command_boundary(reader, false, x_line_next(reader, false));
+        data = reader->peek(1);
+
+        if(data[0] == 0x01) {
+            data = reader->peek(8);
+
+            if(data == NULL) {
+                break;
             }
 
-            for(int i = 0; i < 10; i++) {
-                serial_command.add_byte(command[i]);
+            parse_command(data);
+            reader->consume(8);
+        } else if(data[0] == FIRING_COLUMN) {
+            data = reader->peek(FIRING_COLUMN_SIZE);
 
-                if(command[i] == '\n') {
-                    break;
-                }
+            if(data == NULL) {
+                break;
             }
+
+            fire_frame(data + 1);
+            reader->consume(FIRING_COLUMN_SIZE);
         } else {
-            serial_command.add_byte(command[0]);
+            uint16_t length;
+            char *line = reader->line(&length);
+
+            // The file ended in the tail of a line that was cut short
+            if(line == NULL) {
+                break;
+            }
+
+            // Interactive commands aren't run from a file
+            if(!print_line(line, extents)) {
+                logger.warn() << "Skipping '" << line << "'" << Comms::endl;
+            }
         }
 
         //Check if Any serial commands have been received
-        if(Serial.available()) {
-            if(Serial.peek() == 'S') {
-                myFile.close();
+        if(stop_requested()) {
+            return false;
+        }
+    }
 
-                //swap_motors();
+    return true;
+}
 
-                Serial.println("Stopping.");
+// Compressed .b files are decoded as they are read, the same way as an online
+// print from recv. Decoding carries on from the given state if there is one.
+static bool print_compressed(FileReader *reader, PrintExtents *extents,
+                             const DecbState *decoder) {
+    byte decoded[FILE_READER_SECTOR_SIZE + FILE_READER_CARRY_SIZE];
+    int decoded_length = 0;
+    int length;
+    int result;
+
+    if(decoder) {
+        decb_restore(decoder);
+    } else {
+        decb_init();
+    }
 
-                goto_zero_command();
+    do {
+        // Output left over from the last pass isn't covered by the decoder
+        // state. decb() stops before each X line so every row gets here.
+        if(decoded_length == 0) {
+            command_boundary(reader, true, x_line_next(reader, true));
+        }
 
-                return false;
-            }
-            serialEvent();
+        uint16_t count;
+        char *data = (char *)reader->buffered(&count);
+        int offset = 0;
+
+        length = sizeof(decoded) - decoded_length;
+        result = decb(data, &offset, count, (char *)decoded + decoded_length,
+                &length);
+
+        reader->consume(offset);
+
+        if(result == DECODE_ERROR) {
+            logger.error("Could not decode compressed file");
+
+            return false;
+        }
+
+        int unused = onlinePrint(decoded, decoded_length + length, extents);
+        memmove(decoded, decoded + decoded_length + length - unused, unused);
+        decoded_length = unused;
+
+        if(stop_requested()) {
+            return false;
+        }
+    } while(result == KEEP_GOING || reader->fill());
+
+    // decb() only takes whole lines, anything left is one it never finished
+    uint16_t left;
+    reader->buffered(&left);
+
+    if(left > FILE_READER_CARRY_SIZE) {
+        logger.error() << "Compressed file has a line over "
+                << FILE_READER_CARRY_SIZE << " bytes" << Comms::endl;
+
+        return false;
+    }
+
+    if(left > 0) {
+        logger.error() << "Compressed file is cut short, " << left
+                << " bytes left over" << Comms::endl;
+
+        return false;
+    }
+
+    // Moves still held back over blank columns at the end of the file
+    length = decb_finish((char *)decoded + decoded_length);
+    onlinePrint(decoded, decoded_length + length, extents);
+
+    return true;
+}
+
+static void discard_record(void *context, const uint8_t *data,
+                           uint16_t length) {
+}
+
+// Walks a file through the same parsing as a print, compiling it without
+// moving or firing anything, and reports what printing it would take.
+bool analyseFile(char *filename) {
+    myFile.open(filename);
+
+    if (!myFile.isOpen()) {
+        Serial.print("File could not be opened: ");
+        Serial.println(filename);
+
+        return false;
+    }
+
+    logger.info() << "Analysing '" << filename << "'" << Comms::endl;
+
+    unsigned long start = millis();
+
+    FileReader reader(&myFile);
+    JobWriter writer;
+    JobEstimate estimate;
+    int job = JOB_NOT_A_JOB;
+    uint8_t *data = reader.peek(sizeof(JobHeader));
+    bool walked = false;
+
+    if(data != NULL) {
+        memcpy(&writer.header, data, sizeof(JobHeader));
+        job = job_check_header(&writer.header, myFile.fileSize());
+    }
+
+    if(job == JOB_OK && !verify_job(&reader, &writer.header)) {
+        job = JOB_BAD_CHECKSUM;
+    }
+
+    if(job == JOB_OK || job == JOB_NOT_A_JOB) {
+        PrintExtents extents = {0, 0, 0, 0};
+
+        // Planned as motion.cpp would, at the current speeds and pulse timing
+        job_estimate_init(&estimate,
+                (float)global_settings.motionOptions.acceleration
+                        * Axis::steps_per_mm,
+                x_axis.get_motor()->get_step_rate(),
+                y_axis.get_motor()->get_step_rate(),
+                cartridge_address_ticks());
+
+        job_writer_init(&writer, discard_record, NULL);
+        writer.estimate = &estimate;
+        print_record(&writer, true);
+
+        if(job == JOB_OK) {
+            reader.peek(writer.header.header_size);
+            reader.consume(writer.header.header_size);
+
+            walked = print_job(&reader);
+        } else if(compressed_filename(filename)) {
+            walked = print_compressed(&reader, &extents, NULL);
+        } else {
+            walked = print_text(&reader, &extents);
         }
+
+        print_record(NULL);
+    } else {
+        logger.error() << "Bad job header or checksum (" << job << ")"
+                << Comms::endl;
+    }
+
+    myFile.close();
+
+    if(walked) {
+        uint32_t seconds = job_estimate_finish(&estimate);
+
+        report_job(&writer.header);
+
+        logger.info() << "Estimated time: " << seconds / 60 << " min "
+                << seconds % 60 << " s" << Comms::endl;
+
+        logger.info() << "Analysed in " << (millis() - start) << " ms"
+                << Comms::endl;
     }
 
+    return walked;
+}
+
+// The sidecar index for a print file has the same name with a .idx extension.
+static bool index_filename(const char *filename, char *name, uint8_t size) {
+    const char *dot = strrchr(filename, '.');
+    uint8_t length = dot ? dot - filename : strlen(filename);
+
+    if(length + 5 > size) {
+        return false;
+    }
+
+    memcpy(name, filename, length);
+    strcpy(name + length, ".idx");
+
+    return strcasecmp(name, filename) != 0;
+}
+
+// Walks a file as analyseFile() does, writing an entry to its index at the
+// start of each row and every INDEX_INTERVAL bytes, so a print can start from
+// any row without reading what comes before it.
+bool indexFile(char *filename) {
+    char name[32];
+    SdFile index;
+
+    if(!index_filename(filename, name, sizeof(name))) {
+        logger.error() << "Can't index '" << filename << "'" << Comms::endl;
+
+        return false;
+    }
+
+    myFile.open(filename);
+
+    if (!myFile.isOpen()) {
+        Serial.print("File could not be opened: ");
+        Serial.println(filename);
+
+        return false;
+    }
+
+    index.open(name, O_CREAT | O_WRITE | O_TRUNC);
+
+    if (!index.isOpen()) {
+        Serial.print("File could not be opened: ");
+        Serial.println(name);
+
+        myFile.close();
+
+        return false;
+    }
+
+    unsigned long start = millis();
+
+    FileReader reader(&myFile);
+    JobHeader header;
+    IndexHeader index_header;
+    JobWriter writer;
+    int job = JOB_NOT_A_JOB;
+    uint8_t *data = reader.peek(sizeof(header));
+    bool walked;
+
+    if(data != NULL) {
+        memcpy(&header, data, sizeof(header));
+        job = job_check_header(&header, myFile.fileSize());
+    }
+
+    index_header.magic = INDEX_MAGIC;
+    index_header.version = INDEX_VERSION;
+    index_header.entry_size = sizeof(IndexEntry);
+    index_header.file_size = myFile.fileSize();
+    index_header.entry_count = 0;
+
+    // Space for the header, written again once the entries are counted
+    index.write(&index_header, sizeof(index_header));
+
+    job_writer_init(&writer, discard_record, NULL);
+    print_record(&writer, true);
+
+    index_file = &index;
+    index_writer = &writer;
+    index_count = 0;
+    index_row = 0;
+
+    if(job == JOB_OK) {
+        reader.peek(header.header_size);
+        reader.consume(header.header_size);
+
+        walked = print_job(&reader);
+    } else if(job == JOB_NOT_A_JOB) {
+        PrintExtents extents = {0, 0, 0, 0};
+
+        if(compressed_filename(filename)) {
+            walked = print_compressed(&reader, &extents, NULL);
+        } else {
+            walked = print_text(&reader, &extents);
+        }
+    } else {
+        logger.error() << "Bad job header (" << job << ")" << Comms::endl;
+
+        walked = false;
+    }
+
+    // Moves to an absolute position can't be compiled, so a file with them
+    // is printed from the start rather than from its index
+    bool followed = print_record_complete();
+
+    index_file = NULL;
+    print_record(NULL);
+
+    myFile.close();
+
+    index_header.entry_count = index_count;
+    index.seekSet(0);
+    index.write(&index_header, sizeof(index_header));
+
+    if(walked && !followed) {
+        logger.error() << "'" << filename
+                << "' moves to absolute positions, which can't be indexed"
+                << Comms::endl;
+    }
+
+    if(!walked || !followed || index.getWriteError()) {
+        index.remove();
+
+        logger.error() << "Could not index '" << filename << "'" << Comms::endl;
+
+        return false;
+    }
+
+    index.close();
+
+    logger.info() << "Indexed " << (index_row + 1) << " rows in " << index_count
+            << " entries, " << (millis() - start) << " ms" << Comms::endl;
+
+    return true;
+}
+
+// Looks up where a row starts in a file's index. The position is relative to
+// where the print started.
+bool indexFind(char *filename, uint16_t row, CheckpointData *found) {
+    char name[32];
+    SdFile file;
+    SdFile index;
+    IndexHeader header;
+    IndexEntry entry;
+
+    if(!index_filename(filename, name, sizeof(name)) || !index.open(name)) {
+        logger.error() << "No index for '" << filename << "'" << Comms::endl;
+
+        return false;
+    }
+
+    if(!file.open(filename)) {
+        Serial.print("File could not be opened: ");
+        Serial.println(filename);
+
+        return false;
+    }
+
+    uint32_t size = file.fileSize();
+
+    file.close();
+
+    if(index.read(&header, sizeof(header)) != sizeof(header) ||
+            header.magic != INDEX_MAGIC || header.version != INDEX_VERSION ||
+            header.entry_size != sizeof(IndexEntry) ||
+            header.file_size != size) {
+        logger.error() << "Index for '" << filename << "' is out of date"
+                << Comms::endl;
+
+        return false;
+    }
+
+    // Entries are in row order, find the first one of the row
+    uint32_t low = 0;
+    uint32_t high = header.entry_count;
+
+    while(low < high) {
+        uint32_t middle = (low + high) / 2;
+
+        if(!index.seekSet(sizeof(header) + middle * sizeof(entry)) ||
+                index.read(&entry, sizeof(entry)) != sizeof(entry)) {
+            logger.error("Could not read index");
+
+            return false;
+        }
+
+        if(entry.row < row) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if(low == header.entry_count ||
+            !index.seekSet(sizeof(header) + low * sizeof(entry)) ||
+            index.read(&entry, sizeof(entry)) != sizeof(entry) ||
+            entry.row != row) {
+        logger.error() << "No row " << row << " in '" << filename << "'"
+                << Comms::endl;
+
+        return false;
+    }
+
+    index.close();
+
+    logger.info() << "Row " << row << " starts at byte " << entry.offset
+            << ", column " << entry.column << Comms::endl;
+
+    found->offset = entry.offset;
+    found->x_position = entry.x_position;
+    found->y_position = entry.y_position;
+    memcpy(&found->decoder, &entry.decoder, sizeof(DecbState));
+
+    return true;
+}
+
+// Prints one pass of a file, from the start or from where a checkpoint left
+// off, compiling what it queues into the writer if there is one.
+bool readFile(char *filename, uint8_t pass, uint8_t passes,
+              CheckpointData *resume, JobWriter *record) {
+    //swap_motors();
+
+    //xMotor->set_position(0L);
+    //yMotor->set_position(0L);
+
+    //x_axis.zero();
+    //y_axis.zero();
+
+    // Open File
+    myFile.open(filename);
+
+    // Check if file open succeeded, if not output error message
+    if (!myFile.isOpen()) {
+        Serial.print("File could not be opened: ");
+        Serial.println(filename);
+
+        return false;
+    }
+
+    //Serial.println("Starting");
+    //Serial.println(start);
+    logger.info() << "readFile(" << filename << ")" << Comms::endl;
+
+    FileReader reader(&myFile);
+    JobHeader header;
+    int job = JOB_NOT_A_JOB;
+    uint8_t *data = reader.peek(sizeof(header));
+
+    if(data != NULL) {
+        memcpy(&header, data, sizeof(header));
+        job = job_check_header(&header, myFile.fileSize());
+    }
+
+    if(job == JOB_OK && !verify_job(&reader, &header)) {
+        job = JOB_BAD_CHECKSUM;
+    }
+
+    if(job != JOB_OK && job != JOB_NOT_A_JOB) {
+        if(job == JOB_BAD_VERSION) {
+            logger.error() << "Unsupported job version " << header.version
+                    << Comms::endl;
+        } else if(job == JOB_BAD_CHECKSUM) {
+            logger.error("Job checksum mismatch, not printing");
+        } else {
+            logger.error("Job is incomplete, not printing");
+        }
+
+        myFile.close();
+
+        return false;
+    }
+
+    colour(COLOUR_PRINTING);
+
+    cartridge_reset_statistics();
+    unsigned long print_start = millis();
+
+    PrintExtents extents = {0, 0, 0, 0};
+    bool compressed = job != JOB_OK && compressed_filename(filename);
+    bool printed;
+
+    if(resume) {
+        reader.seek(resume->offset);
+
+        extents.cur_x = extents.max_x = resume->x_position;
+        extents.cur_y = extents.max_y = resume->y_position;
+    } else if(job == JOB_OK) {
+        reader.peek(header.header_size);
+        reader.consume(header.header_size);
+    }
+
+    strncpy(checkpoint.filename, filename, sizeof(checkpoint.filename) - 1);
+    checkpoint.filename[sizeof(checkpoint.filename) - 1] = 0;
+    checkpoint.pass = pass;
+    checkpoint.passes = passes;
+
+    if(resume) {
+        memcpy(&checkpoint.decoder, &resume->decoder, sizeof(DecbState));
+    } else {
+        decb_init();
+        decb_save(&checkpoint.decoder);
+    }
+
+    save_checkpoint(&reader, false);
+
+    prefetch_reader = &reader;
+    motion_set_idle(prefetch_sector);
+
+    // A job is already compiled
+    if(job != JOB_OK) {
+        print_record(record);
+    }
+
+    if(job == JOB_OK) {
+        report_job(&header);
+
+        extents.max_x = header.x_extent;
+        extents.max_y = header.y_extent;
+
+        printed = print_job(&reader);
+    } else if(compressed) {
+        printed = print_compressed(&reader, &extents, &checkpoint.decoder);
+    } else {
+        printed = print_text(&reader, &extents);
+    }
+
+    motion_set_idle(NULL);
+    print_record(NULL);
+
+    if(!printed) {
+        myFile.close();
+
+        return false;
+    }
+
+    motion_wait();
+
+    cartridge_report_statistics(millis() - print_start);
+
     colour(COLOUR_FINISHED);
 
-    logger.info() << "File dimensions: " << max_x << " x " << max_y << " steps"
-            << Comms::endl;
+    logger.info() << "File dimensions: " << extents.max_x << " x "
+            << extents.max_y << " steps" << Comms::endl;
 
-    x_size = max_x;
-    y_size = max_y;
+    x_size = extents.max_x;
+    y_size = extents.max_y;
 
     //close file
     myFile.close();
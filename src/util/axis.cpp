@@ -1,16 +1,19 @@
 #include "axis.h"
 #include "logging.h"
+#include "motion.h"
+
+#include <util/atomic.h>
 
 #include "../argentum/argentum.h"
 
 Axis::Axis(const char axis,
            Stepper *motor,
-           bool (*positive_limit)(void),
-           bool (*negative_limit)(void)) {
+           uint8_t positive_limit_mask,
+           uint8_t negative_limit_mask) {
     this->axis = axis;
     this->motor = motor;
-    this->positive_limit = positive_limit;
-    this->negative_limit = negative_limit;
+    this->positive_limit_mask = positive_limit_mask;
+    this->negative_limit_mask = negative_limit_mask;
 
     length = 0;
     current_position = 0;
@@ -20,6 +23,8 @@ Axis::Axis(const char axis,
 
     direction = Axis::Positive;
 
+    limit_reached = false;
+
     motor->set_speed(1000);
 
     //logger.info() << "Axis created for: " << axis << Comms::endl;
@@ -29,36 +34,73 @@ Axis::~Axis() {
 }
 
 bool Axis::run(void) {
-    if(current_position == desired_position) {
-        return false;
-    } else {
-        //logger.info() << current_position << " -> " << desired_position
-        //        << Logger::endl;
-
-        /*if(desired_position == Axis::PositiveLimit) {
-            if(positive_limit()) {
-                logger.info("reached positive limit");
-            } else {
-                return step();
-            }
-        }*/
+    if(limit_reached) {
+        limit_reached = false;
 
-        if(((current_position < desired_position) && positive_limit())
-                || ((current_position > desired_position)
-                && negative_limit())) {
-            logger.warn() << axis
-                    << " tried to step in a limited direction, holding."
-                    << " current_position: " << current_position
-                    << " desired_position: " << desired_position
-                    << Comms::endl;
+        logger.warn() << axis
+                << " tried to step in a limited direction, holding."
+                << " current_position: " << get_current_position()
+                << Comms::endl;
+    }
 
-            hold();
+    return moving();
+}
+
+// Called from the step interrupt when the current line needs a step from this
+// axis, with the limit switches it read on this tick. Returns false, and holds
+// the axis, if the limit switch in the direction of travel is triggered.
+bool Axis::interrupt_step(uint8_t switches) {
+    if(direction == Axis::Positive) {
+        if(switches & positive_limit_mask) {
+            desired_position = current_position;
+            limit_reached = true;
+            return false;
+        }
 
+        motor->pulse();
+        current_position++;
+    } else {
+        if(switches & negative_limit_mask) {
+            desired_position = current_position;
+            limit_reached = true;
             return false;
         }
 
-        return step();
+        motor->pulse();
+
+        if(current_position > 0) {
+            current_position--;
+        }
     }
+
+    return true;
+}
+
+// Used by the motion engine when a line is queued. The goal is where this axis
+// will be once every queued line has run, and the return value is the signed
+// number of steps from the previous goal.
+int32_t Axis::set_goal(uint32_t position) {
+    // Constrain the possible positions
+    position = constrain_position(position);
+
+    int32_t steps = (int32_t)position - (int32_t)desired_position;
+
+    desired_position = position;
+
+    return steps;
+}
+
+uint32_t Axis::constrain_position(uint32_t position) {
+    // This could really be ~14000
+    return min(position, 16000);
+}
+
+bool Axis::positive_limit(void) {
+    return (limit_switches() & positive_limit_mask);
+}
+
+bool Axis::negative_limit(void) {
+    return (limit_switches() & negative_limit_mask);
 }
 
 bool Axis::step(void) {
@@ -109,54 +151,38 @@ void Axis::set_direction(uint8_t direction) {
     //        << Comms::endl;
 }
 
-void Axis::move_absolute(double position) {
-    if(position < 0) {
-        logger.error() << axis << " absolute movement with negative position ("
-                << position << ")";
-    }
-
-    uint32_t pos = position * steps_per_mm;
-
-    move_absolute(pos);
+void Axis::move_absolute_um(uint32_t position) {
+    move_absolute(um_to_steps(position));
 }
 
+// Single axis moves are lines where the other axis stays at its goal.
 void Axis::move_absolute(uint32_t position) {
-    if(position == desired_position || position == current_position) {
-        return;
-    }
-
     //logger.info() << axis << " axis absolute movement from " << current_position
     //    << " to " << position << "" << Comms::endl;
 
-    // Constrain the possible positions
-    desired_position = max(position, 0);
-
-    // This could really be ~14000
-    desired_position = min(desired_position, 16000);
-
-    //logger.info() << axis << " axis setting new desired position to "
-    //    << desired_position << Comms::endl;
-
-    if(desired_position > current_position) {
-        set_direction(Axis::Positive);
+    if(axis == Axis::X) {
+        motion_move_to(position, y_axis.get_desired_position());
     } else {
-        set_direction(Axis::Negative);
+        motion_move_to(x_axis.get_desired_position(), position);
     }
 }
 
-void Axis::move_incremental(double increment) {
-    int32_t steps = increment * steps_per_mm;
-
-    move_incremental(steps);
+void Axis::move_incremental_um(int32_t increment) {
+    if(increment < 0) {
+        move_incremental(-(int32_t)um_to_steps(-increment));
+    } else {
+        move_incremental((int32_t)um_to_steps(increment));
+    }
 }
 
 void Axis::move_incremental(int32_t increment) {
-    uint32_t new_desired_position = desired_position + increment;
+    uint32_t goal = get_desired_position();
+    uint32_t new_desired_position = goal + increment;
 
     //logger.info() << axis << " axis given increment of (" << increment
     //        << ")" << Comms::endl;
 
-    if(((int32_t)desired_position + increment) < 0) {
+    if(((int32_t)goal + increment) < 0) {
         logger.error() << axis << " axis given incremental move below 0.000 ("
                 << increment << ")" << Comms::endl;
 
@@ -167,6 +193,8 @@ void Axis::move_incremental(int32_t increment) {
 }
 
 void Axis::move_to_positive(void) {
+    motion_wait();
+
     set_direction(Axis::Positive);
 
     bool startingAtNegLimit = negative_limit();
@@ -181,9 +209,13 @@ void Axis::move_to_positive(void) {
             break;
         }
     }
+
+    hold();
 }
 
 void Axis::move_to_negative(void) {
+    motion_wait();
+
     set_direction(Axis::Negative);
 
     bool startingAtPosLimit = positive_limit();
@@ -198,41 +230,88 @@ void Axis::move_to_negative(void) {
             break;
         }
     }
+
+    hold();
+}
+
+uint32_t Axis::get_current_position_um(void) {
+    return steps_to_um(get_current_position());
+}
+
+uint32_t Axis::get_desired_position_um(void) {
+    return steps_to_um(get_desired_position());
 }
 
-double Axis::get_current_position_mm(void) {
-    return ((double)current_position) / steps_per_mm;
+// Integer conversions, rounded to the nearest step or micrometre.
+uint32_t Axis::um_to_steps(uint32_t um) {
+    return (um * steps_per_mm + 500) / 1000;
 }
 
-double Axis::get_desired_position_mm(void) {
-    return ((double)desired_position) / steps_per_mm;
+uint32_t Axis::steps_to_um(uint32_t steps) {
+    return (steps * 1000 + steps_per_mm / 2) / steps_per_mm;
 }
 
 uint32_t Axis::get_current_position(void) {
-    return current_position;
+    uint32_t position;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        position = current_position;
+    }
+
+    return position;
 }
 
 uint32_t Axis::get_desired_position(void) {
-    return desired_position;
+    uint32_t position;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        position = desired_position;
+    }
+
+    return position;
 }
 
 void Axis::zero(void) {
-    current_position = 0;
-    desired_position = 0;
+    set_position(0);
 }
 
+void Axis::set_position(uint32_t position) {
+    motion_wait();
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        current_position = position;
+        desired_position = position;
+    }
+}
+
+bool Axis::limit_hit(void) {
+    bool hit = limit_reached;
+
+    limit_reached = false;
+
+    return hit;
+}
+
+// The step interrupt notices the goal has been reached on its next tick and
+// stops itself.
 void Axis::hold(void) {
-    desired_position = current_position;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        desired_position = current_position;
+    }
 }
 
 bool Axis::moving(void) {
-    return (current_position != desired_position);
+    bool moving;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        moving = (current_position != desired_position);
+    }
+
+    return moving;
 }
 
 void Axis::wait_for_move(void) {
-    while(moving()) {
-        run();
-    }
+    while(run());
 }
 
 void Axis::set_speed(uint32_t mm_per_minute) {
@@ -28,6 +28,7 @@ SOFTWARE.
 #define _AXIS_H_
 
 #include "stepper.h"
+#include "limit.h"
 
 class Axis {
 public:
@@ -48,28 +49,38 @@ public:
         NegativeLimit = -123456789
     };
 
-    Axis(const char axis, Stepper *motor, bool (*positive_limit_function)(void), bool (*negative_limit_function)(void));
+    // The limit masks are the *_BIT values from limit.h for this axis.
+    Axis(const char axis, Stepper *motor, uint8_t positive_limit_mask, uint8_t negative_limit_mask);
     ~Axis();
 
     bool run(void);
 
-    void move_absolute(double position);
     void move_absolute(uint32_t position);
-
-    void move_incremental(double increment);
     void move_incremental(int32_t increment);
 
     void move_to_positive(void);
     void move_to_negative(void);
 
-    double get_current_position_mm(void);
-    double get_desired_position_mm(void);
+    // Positions in whole micrometres, without going through floating point.
+    void move_absolute_um(uint32_t position);
+    void move_incremental_um(int32_t increment);
+    uint32_t get_current_position_um(void);
+    uint32_t get_desired_position_um(void);
+
+    static uint32_t um_to_steps(uint32_t um);
+    static uint32_t steps_to_um(uint32_t steps);
     uint32_t get_current_position(void);
     uint32_t get_desired_position(void);
 
     void zero(void);
     void hold(void);
 
+    // Declare the axis to be at the given position, without moving it.
+    void set_position(uint32_t position);
+
+    // True, once, if a line was cut short by this axis hitting a limit.
+    bool limit_hit(void);
+
     bool moving(void);
     void wait_for_move(void);
 
@@ -83,25 +94,34 @@ public:
 
     static const long steps_per_mm = 80;
 
-    uint32_t current_position;
+    enum StepDirection {
+        Positive = 0,
+        Negative = 1
+    };
+
+    // Used by the motion engine to drive this axis along a line.
+    int32_t set_goal(uint32_t position);
+    void set_direction(uint8_t direction);
+    bool interrupt_step(uint8_t switches);
+
+    uint32_t constrain_position(uint32_t position);
+
+    volatile uint32_t current_position;
 
     uint32_t length;
 
     void debug_info(void);
 
 private:
-    enum StepDirection {
-        Positive = 0,
-        Negative = 1
-    };
-
     bool step(void);
-    void set_direction(uint8_t direction);
 
     char axis;
 
-    bool (*positive_limit)(void);
-    bool (*negative_limit)(void);
+    uint8_t positive_limit_mask;
+    uint8_t negative_limit_mask;
+
+    bool positive_limit(void);
+    bool negative_limit(void);
 
     Stepper *motor;
 
@@ -109,7 +129,9 @@ private:
 
     uint8_t motor_mapping;
 
-    uint32_t desired_position;
+    volatile uint32_t desired_position;
+
+    volatile bool limit_reached;
 };
 
 #endif
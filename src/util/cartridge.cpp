@@ -1,11 +1,39 @@
-
 #include "cartridge.h"
+#include "logging.h"
+#include "motion.h"
+#include "utils.h"
+
+#include <util/atomic.h>
+
+extern "C" {
+#include "profile.h"
+}
+
+static uint16_t columns_fired = 0;
+static uint16_t longest_column = 0;
+
+// Pulse timing in motion timer ticks
+static uint8_t hold_ticks = 1;
+static uint8_t pulse_ticks = 13;
 
 void cartridge_initialise(void) {
     // Configure Cartridge Ports
     DDRC = 0xFF;
     DDRL = 0xFF;
     DDRA = 0xFF;
+
+    cartridge_configure(&global_settings.cartridgeOptions);
+}
+
+static uint8_t ticks_from_ns(uint16_t ns) {
+    uint16_t ticks = (ns + 250) / 500;
+
+    return constrain(ticks, 1, 255);
+}
+
+void cartridge_configure(CartridgeOptionsData *options) {
+    hold_ticks = ticks_from_ns(options->address_hold);
+    pulse_ticks = ticks_from_ns(options->pulse_width);
 }
 
 // PORT C is [R1, R2, R3, R4, L1, L2, L3, L4] (Multiplexer)
@@ -14,172 +42,109 @@ void cartridge_initialise(void) {
 
 // Put in to a printhead class
 
-/*
+// The set pulse width, corrected for the latest primitive voltage sample.
+static uint8_t compensated_pulse(void) {
+    uint16_t ticks = ((uint32_t)pulse_ticks * primitive_pulse_scale()) >> 8;
 
-.global _Z8fireHeadhhhh
-    .type   _Z8fireHeadhhhh, @function
-_Z8fireHeadhhhh:
-    push r29
-    push r28
-    in r28,__SP_L__
-    in r29,__SP_H__
-    sbiw r28,8
-    in __tmp_reg__,__SREG__
-    cli
-    out __SP_H__,r29
-    out __SREG__,__tmp_reg__
-    out __SP_L__,r28
+    return min(ticks, 255);
+}
+
+// Wait until at least the given number of whole timer ticks have passed.
+static inline void wait_ticks(uint16_t start, uint8_t ticks) {
+    while((uint16_t)(TCNT1 - start) <= ticks);
+}
 
-*/
+// Drive one multiplexer address and pulse the primitives on it, with each
+// phase gated by the motion timer. Must be called with interrupts disabled, so
+// that nothing can stretch the pulse or use timer 1's 16-bit register latch.
+static inline void fire_address(uint8_t address, uint8_t rPrim, uint8_t lPrim,
+                                uint8_t pulse) {
+    uint16_t start = TCNT1;
+
+    // Address (t_h)
+    PORTC = address;
+    wait_ticks(start, hold_ticks);
+
+    // Primitives (t_pw)
+    start = TCNT1;
+    PORTL = lPrim;
+    PORTA = rPrim;
+    wait_ticks(start, pulse);
+
+    start = TCNT1;
+    PORTA = 0;
+    PORTL = 0;
+    wait_ticks(start, hold_ticks);
+
+    PORTC = 0;
+}
 
 void fire_head(uint8_t rPrim, uint8_t rAddr, uint8_t lPrim, uint8_t lAddr) {
-    int x1, x2;
-    /*
-
-        // prologue: function
-        // frame size = 8
-        std Y+5,r24
-        std Y+6,r22
-        std Y+7,r20
-        std Y+8,r18
-        ldd r24,Y+5
-        tst r24
-        brne .L25
-        ldd r24,Y+6
-        tst r24
-        brne .L25
-        ldd r24,Y+7
-        tst r24
-        brne .L25
-        ldd r24,Y+8
-        tst r24
-        brne .+2
-        rjmp .L27
-
-    */
     if (rPrim || rAddr || lPrim || lAddr) {
-        /*
-
-            .L25:
-            ldi r26,lo8(40)
-            ldi r27,hi8(40)
-            ldi r30,lo8(40)
-            ldi r31,hi8(40) // 40 is PORTC
-            ld r25,Z
-            ldd r24,Y+8 // Y+8 is lAddr
-            or r24,r25 // PORTC | lAddr
-            st X,r24
-            ldi r26,lo8(40)
-            ldi r27,hi8(40)
-            ldi r30,lo8(40)
-            ldi r31,hi8(40) // 40 is PORTC
-            ld r24,Z
-            mov r18,r24
-            ldd r24,Y+6 // Y+6 is rAddr
-            mov r24,r24 // ?
-            ldi r25,lo8(0)
-            swap r24
-            swap r25
-            andi r25,0xf0
-            eor r25,r24
-            andi r24,0xf0
-            eor r25,r24
-            or r24,r18
-            st X,r24
-
-        */
-
-        //x1 = int(rAddr) << 4 | int(rAddr) >4; //Reverse
-        //x2 = (x1 & 0x33) << 2 | (x1 & 0xcc) >2;
-        //PORTC = (PORTC | ((x2 & 0x55) << 1 | (x2 & 0xaa) >1);
-
-        // 2.6µS outer (t_h)
-        // 2.5µS inner (t_pw)
-
-        // Address
-        PORTC = (PORTC | int(lAddr));
-        PORTC = (PORTC | (int(rAddr) << 4));
-
-        asm volatile("nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-        );
-
-        /*
-
-            ldi r30,lo8(267)
-            ldi r31,hi8(267)
-            ldd r24,Y+7
-            st Z,r24
-
-            ldi r30,lo8(34)
-            ldi r31,hi8(34)
-            ldd r24,Y+5
-            st Z,r24
-
-            ldi r24,lo8(6)
-            ldi r25,hi8(6)
-            call delayMicroseconds
-
-        */
-
-        // Primitives
-        PORTL = int(lPrim);
-        PORTA = int(rPrim);
-
-        delayMicroseconds(6);
-
-        asm volatile("nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-        );
-
-        /*
-
-            ldi r30,lo8(34)
-            ldi r31,hi8(34)
-            st Z,__zero_reg__
-
-            ldi r30,lo8(267)
-            ldi r31,hi8(267)
-            st Z,__zero_reg__
-
-        */
-        PORTA = 0;
-        PORTL = 0;
-
-        asm volatile("nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t"
-                     "nop\n\t");
-
-        /*
-
-            ldi r30,lo8(40)
-            ldi r31,hi8(40)
-            st Z,__zero_reg__
-
-        */
-        PORTC = 0;
-        //delayMicroseconds(500);
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            fire_address(lAddr | (rAddr << 4), rPrim, lPrim,
+                         compensated_pulse());
+        }
+    }
+}
+
+void fire_column(const uint8_t *frame) {
+    uint16_t start = motion_ticks();
+    uint8_t pulse = compensated_pulse();
+
+    for(uint8_t i = 0; i < FIRING_ADDRESSES; i++, frame += 3) {
+        uint8_t address = frame[0];
+        uint8_t rPrim = frame[1];
+        uint8_t lPrim = frame[2];
+
+        if(!(rPrim || lPrim)) {
+            continue;
+        }
+
+        // The address is shared by both sides. Interrupts are only held off
+        // for one address at a time.
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            fire_address(address | (address << 4), rPrim, lPrim, pulse);
+        }
+    }
+
+    uint16_t ticks = motion_ticks() - start;
+
+    if(ticks > longest_column) {
+        longest_column = ticks;
+    }
+
+    columns_fired++;
+}
+
+uint16_t cartridge_address_ticks(void) {
+    return profile_address_ticks(hold_ticks, pulse_ticks);
+}
+
+void cartridge_reset_statistics(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        columns_fired = 0;
+        longest_column = 0;
+    }
+}
+
+void cartridge_report_statistics(unsigned long elapsed_ms) {
+    logger.info() << "Fired " << columns_fired << " columns in " << elapsed_ms
+            << " ms" << Comms::endl;
+
+    if(longest_column == 0) {
+        return;
+    }
+
+    // Motion timer ticks are half a microsecond
+    uint32_t longest_us = longest_column / 2;
+
+    logger.info() << "Longest column took " << longest_us << " us, a limit of "
+            << (MOTION_TICKS_PER_SECOND / longest_column) << " columns/s"
+            << Comms::endl;
+
+    if(elapsed_ms > 0) {
+        logger.info() << "Achieved " << ((uint32_t)columns_fired * 1000
+                / elapsed_ms) << " columns/s" << Comms::endl;
     }
 }
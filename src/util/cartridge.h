@@ -2,8 +2,30 @@
 #define _CARTRIDGE_H_
 
 #include <Arduino.h>
+#include "settings.h"
+
+extern "C" {
+#include "decb.h"
+}
 
 void cartridge_initialise(void);
+
+// Take up new pulse timing, cartridge_initialise() does this from the stored
+// settings.
+void cartridge_configure(CartridgeOptionsData *options);
 void fire_head(uint8_t rPrim, uint8_t rAddr, uint8_t lPrim, uint8_t lAddr);
 
+// Fire every address of a column frame (see decb.h) back to back, with the
+// same pulse timing as fire_head(). Pulse phases are timed on the motion timer
+// with interrupts held off, so this is safe to call from the step interrupt.
+void fire_column(const uint8_t *frame);
+
+// Time fire_head(), or each address in use in a column, takes at the current
+// pulse timing, in motion timer ticks, before voltage compensation.
+uint16_t cartridge_address_ticks(void);
+
+// Columns fired since the last reset, and the longest any took.
+void cartridge_reset_statistics(void);
+void cartridge_report_statistics(unsigned long elapsed_ms);
+
 #endif
@@ -11,6 +11,10 @@ static char lastFiring[4];
 static char lastParts[50];
 static char nLastParts;
 
+// Y steps of blank columns not yet written out. They are written as one move
+// before the next output, so a run of blank columns is a single carriage move.
+static long pendingY;
+
 #ifdef DEBUG
 int lineno = 0;
 #endif
@@ -21,6 +25,25 @@ void decb_init()
     lastFiring[0] = 0;
     memset(lastParts, 0, 50);
     nLastParts = 0;
+    pendingY = 0;
+}
+
+void decb_save(DecbState *state)
+{
+    memcpy(state->lastFiringLine, lastFiringLine, sizeof(lastFiringLine));
+    memcpy(state->lastFiring, lastFiring, sizeof(lastFiring));
+    memcpy(state->lastParts, lastParts, sizeof(lastParts));
+    state->nLastParts = nLastParts;
+    state->pendingY = pendingY;
+}
+
+void decb_restore(const DecbState *state)
+{
+    memcpy(lastFiringLine, state->lastFiringLine, sizeof(lastFiringLine));
+    memcpy(lastFiring, state->lastFiring, sizeof(lastFiring));
+    memcpy(lastParts, state->lastParts, sizeof(lastParts));
+    nLastParts = state->nLastParts;
+    pendingY = state->pendingY;
 }
 
 static int ishexdigit(char ch)
@@ -28,6 +51,50 @@ static int ishexdigit(char ch)
     return ch >= '0' && ch <= '9' || ch >= 'A' && ch <= 'F';
 }
 
+static uint8_t hexvalue(char ch)
+{
+    return ch <= '9' ? ch - '0' : ch - 'A' + 10;
+}
+
+static uint8_t hexbyte(const char *digits)
+{
+    return (hexvalue(digits[0]) << 4) | hexvalue(digits[1]);
+}
+
+// Write out the pending Y steps, returning the number of bytes written.
+static int flushMove(char *out)
+{
+    char digits[10];
+    int ndigits = 0;
+    int len = 4;
+    unsigned long steps = pendingY < 0 ? -pendingY : pendingY;
+
+    // A move of zero means go home, so an empty run must not write one
+    if (pendingY == 0)
+        return 0;
+
+    do
+    {
+        digits[ndigits++] = '0' + steps % 10;
+        steps /= 10;
+    } while (steps);
+
+    memcpy(out, "M Y ", 4);
+    if (pendingY < 0)
+        out[len++] = '-';
+    while (ndigits)
+        out[len++] = digits[--ndigits];
+    out[len++] = '\n';
+
+    pendingY = 0;
+    return len;
+}
+
+int decb_finish(char *outbuf)
+{
+    return flushMove(outbuf);
+}
+
 int decb(char *inbuf, int *pinoff, int inlen, char *outbuf, int *poutlen)
 {
     int outlen = *poutlen;
@@ -53,8 +120,9 @@ int decb(char *inbuf, int *pinoff, int inlen, char *outbuf, int *poutlen)
 
         if (line[0] == '#')
         {
-            if (*poutlen + lineLen + lineLen + 1 > outlen)
+            if (*poutlen + lineLen + lineLen + 1 + DECB_MOVE_MAX > outlen)
                 return KEEP_GOING;
+            *poutlen += flushMove(outbuf + *poutlen);
             memcpy(outbuf + *poutlen, line, lineLen + 1);
             *poutlen += lineLen + 1;
             *pinoff += lineLen + 1;
@@ -63,8 +131,12 @@ int decb(char *inbuf, int *pinoff, int inlen, char *outbuf, int *poutlen)
 
         if (line[0] == 'X')
         {
-            if (*poutlen + lineLen + 4 > outlen)
+            // Each row starts a call of its own
+            if (*poutlen > 0)
                 return KEEP_GOING;
+            if (*poutlen + lineLen + 4 + DECB_MOVE_MAX > outlen)
+                return KEEP_GOING;
+            *poutlen += flushMove(outbuf + *poutlen);
             memcpy(outbuf + *poutlen, "M X ", 4);
             memcpy(outbuf + *poutlen + 4, line + 1, lineLen);
             *poutlen += 4 + lineLen;
@@ -74,8 +146,17 @@ int decb(char *inbuf, int *pinoff, int inlen, char *outbuf, int *poutlen)
 
         if (ncommas == 0 && line[0] != 'd')
         {
-            if (*poutlen + lineLen + 5 > outlen)
+            long steps = atol(line);
+            if (steps != 0)
+            {
+                pendingY += steps;
+                *pinoff += lineLen + 1;
+                continue;
+            }
+
+            if (*poutlen + lineLen + 5 + DECB_MOVE_MAX > outlen)
                 return KEEP_GOING;
+            *poutlen += flushMove(outbuf + *poutlen);
             memcpy(outbuf + *poutlen, "M Y ", 4);
             memcpy(outbuf + *poutlen + 4, line, lineLen+1);
             *poutlen += 5 + lineLen;
@@ -100,7 +181,7 @@ int decb(char *inbuf, int *pinoff, int inlen, char *outbuf, int *poutlen)
         char *order="84C2A6E195D3B";
         if (ncommas == 12 || firingLine)
         {
-            if (outlen - *poutlen < 13 * 8)
+            if (outlen - *poutlen < FIRING_COLUMN_SIZE + DECB_MOVE_MAX)
                 return KEEP_GOING;
             if (firingLine == 0)
             {
@@ -117,8 +198,10 @@ int decb(char *inbuf, int *pinoff, int inlen, char *outbuf, int *poutlen)
             int firingLineLen = firingLine ? strlen(firingLine) : lineLen;
             firingLine = firingLine ? firingLine : line;
             char *value = firingLine;
+            uint8_t frame[FIRING_COLUMN_SIZE];
+            uint8_t fired = 0;
             int i;
-            for (i = 0; i < 13; i++)
+            for (i = 0; i < FIRING_ADDRESSES; i++)
             {
                 char zone[4];
                 char *firing = NULL;
@@ -258,13 +341,20 @@ int decb(char *inbuf, int *pinoff, int inlen, char *outbuf, int *poutlen)
                 }
                 memcpy(lastFiring, firing, 4);
 
-                memcpy(outbuf + *poutlen, "F ", 2);
-                outbuf[*poutlen + 2] = order[i];
-                memcpy(outbuf + *poutlen + 3, firing, 4);
-                outbuf[*poutlen + 7] = '\n';
-                *poutlen += 8;
+                frame[1 + i * 3] = hexvalue(order[i]);
+                frame[2 + i * 3] = hexbyte(firing);
+                frame[3 + i * 3] = hexbyte(firing + 2);
+                fired |= frame[2 + i * 3] | frame[3 + i * 3];
             }
 
+            // Blank columns only move the carriage
+            if (fired)
+            {
+                *poutlen += flushMove(outbuf + *poutlen);
+                frame[0] = FIRING_COLUMN;
+                memcpy(outbuf + *poutlen, frame, FIRING_COLUMN_SIZE);
+                *poutlen += FIRING_COLUMN_SIZE;
+            }
             *pinoff += lineLen + 1;
             continue;
         }
@@ -355,6 +445,8 @@ int main(int argc, char **argv)
         inoff = len-inoff;
     }
 
+    fwrite(buf2, 1, decb_finish(buf2), fout);
+
     fclose(f);
     fclose(fout);
     return 0;
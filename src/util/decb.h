@@ -1,6 +1,40 @@
+#ifndef _DECB_H_
+#define _DECB_H_
+
 void decb_init();
 
+// Firing lines decode to a binary column frame: FIRING_COLUMN followed by
+// FIRING_ADDRESSES groups of address, right primitives and left primitives,
+// in fire_head() order. Moves and comments stay as text lines.
+#define FIRING_COLUMN 0x02
+#define FIRING_ADDRESSES 13
+#define FIRING_COLUMN_SIZE (1 + FIRING_ADDRESSES * 3)
+
+// decb() returns KEEP_GOING once the output is full, and before an X move
+// unless that is the first thing it writes, so that every row starts at the
+// beginning of a call's output with the input offset and decoder state there.
 #define KEEP_GOING 0
 #define NEED_MORE_DATA 1
 #define DECODE_ERROR 2
 int decb(char *inbuf, int *pinoff, int inlen, char *outbuf, int *poutlen);
+
+// Blank firing lines produce no output, and the Y moves around them are
+// gathered into one move. Call this at the end of the input to write out the
+// last of them. Returns the number of bytes written, at most DECB_MOVE_MAX.
+#define DECB_MOVE_MAX 16
+int decb_finish(char *outbuf);
+
+// Everything decb() carries from one line to the next, so that decoding can
+// pick up again part way through a file.
+typedef struct {
+    char lastFiringLine[65];
+    char lastFiring[4];
+    char lastParts[50];
+    char nLastParts;
+    long pendingY;
+} DecbState;
+
+void decb_save(DecbState *state);
+void decb_restore(const DecbState *state);
+
+#endif
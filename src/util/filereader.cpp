@@ -0,0 +1,197 @@
+#include "filereader.h"
+
+#include <string.h>
+
+FileReader::FileReader(SdFile *file) :
+    file(file),
+    start(FILE_READER_CARRY_SIZE),
+    end(FILE_READER_CARRY_SIZE),
+    discard(false),
+    buffer(buffers[0]),
+    next(buffers[1]),
+    next_count(0) {
+}
+
+void FileReader::prefetch(void) {
+    if(next_count == 0) {
+        int16_t count = file->read(next + FILE_READER_CARRY_SIZE,
+                FILE_READER_SECTOR_SIZE);
+
+        next_count = count > 0 ? count : -1;
+    }
+}
+
+// Switch to the next sector, reading it now if it wasn't prefetched, with what
+// is left of this one copied just in front of it.
+bool FileReader::fill(void) {
+    uint16_t left = end - start;
+
+    if(left > FILE_READER_CARRY_SIZE) {
+        return false;
+    }
+
+    prefetch();
+
+    if(next_count < 0) {
+        return false;
+    }
+
+    memcpy(next + FILE_READER_CARRY_SIZE - left, buffer + start, left);
+
+    uint8_t *previous = buffer;
+
+    buffer = next;
+    next = previous;
+
+    start = FILE_READER_CARRY_SIZE - left;
+    end = FILE_READER_CARRY_SIZE + next_count;
+    next_count = 0;
+
+    return true;
+}
+
+uint8_t *FileReader::peek(uint8_t count) {
+    while(end - start < count) {
+        if(!fill()) {
+            return NULL;
+        }
+    }
+
+    return buffer + start;
+}
+
+void FileReader::consume(uint16_t count) {
+    start += count;
+}
+
+uint8_t *FileReader::buffered(uint16_t *count) {
+    *count = end - start;
+
+    return buffer + start;
+}
+
+uint8_t *FileReader::read(uint16_t *count) {
+    if(start == end && !fill()) {
+        return NULL;
+    }
+
+    uint8_t *data = buffer + start;
+
+    *count = end - start;
+    start = end;
+
+    return data;
+}
+
+void FileReader::rewind(void) {
+    file->seekSet(0);
+
+    start = FILE_READER_CARRY_SIZE;
+    end = FILE_READER_CARRY_SIZE;
+    discard = false;
+    next_count = 0;
+}
+
+uint32_t FileReader::position(void) {
+    uint32_t position = file->curPosition() - (end - start);
+
+    if(next_count > 0) {
+        position -= next_count;
+    }
+
+    return position;
+}
+
+// Reads stay sector aligned, the part of the sector before the position is
+// read and skipped.
+bool FileReader::seek(uint32_t position) {
+    uint16_t skip = position % FILE_READER_SECTOR_SIZE;
+
+    rewind();
+
+    if(!file->seekSet(position - skip)) {
+        return false;
+    }
+
+    if(skip && !fill()) {
+        return false;
+    }
+
+    if(skip > end - start) {
+        return false;
+    }
+
+    consume(skip);
+
+    return true;
+}
+
+// Drop the rest of a line that line() had to cut short.
+bool FileReader::skip_line(void) {
+    for(;;) {
+        uint8_t *p = (uint8_t *)memchr(buffer + start, '\n', end - start);
+
+        if(p != NULL) {
+            start = p - buffer + 1;
+            discard = false;
+
+            return true;
+        }
+
+        start = end;
+
+        if(!fill()) {
+            return false;
+        }
+    }
+}
+
+char *FileReader::line(uint16_t *length) {
+    if(discard && !skip_line()) {
+        return NULL;
+    }
+
+    uint16_t scanned = 0;
+    uint8_t *p;
+
+    for(;;) {
+        p = (uint8_t *)memchr(buffer + start + scanned, '\n',
+                end - start - scanned);
+
+        if(p != NULL) {
+            break;
+        }
+
+        scanned = end - start;
+
+        if(!fill()) {
+            if(start == end) {
+                return NULL;
+            }
+
+            if(scanned > FILE_READER_CARRY_SIZE) {
+                // Too long to carry over, keep the front and drop the rest.
+                p = buffer + start + FILE_READER_CARRY_SIZE;
+                discard = true;
+            } else {
+                // Last line in the file has no '\n'.
+                p = buffer + end;
+            }
+
+            break;
+        }
+    }
+
+    char *line = (char *)buffer + start;
+
+    *length = (char *)p - line;
+    *p = 0x00;
+
+    start = p - buffer;
+
+    if(start < end) {
+        start++;
+    }
+
+    return line;
+}
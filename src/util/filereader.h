@@ -0,0 +1,78 @@
+#ifndef _FILEREADER_H_
+#define _FILEREADER_H_
+
+#include <stdint.h>
+#include "SdFat/SdFat.h"
+
+// Reads are always a whole sector at a sector aligned file offset, so SdFat
+// reads straight into the buffer rather than going through its cache and
+// read()/peek() for every byte.
+#define FILE_READER_SECTOR_SIZE 512
+
+// Unread bytes are moved in front of the next sector on a refill, so a record
+// or line of up to this many bytes can always be seen in one piece.
+#define FILE_READER_CARRY_SIZE 64
+
+class FileReader {
+public:
+    FileReader(SdFile *file);
+
+    // Pointer to the next count bytes, refilling if they straddle a sector.
+    // NULL if the file ends first or count is more than FILE_READER_CARRY_SIZE.
+    uint8_t *peek(uint8_t count);
+
+    // Step over bytes already looked at through peek() or buffered().
+    void consume(uint16_t count);
+
+    // Everything buffered and not yet stepped over, without refilling.
+    uint8_t *buffered(uint16_t *count);
+
+    // Read the next sector in behind what is still buffered. False at the end
+    // of the file, or if more than FILE_READER_CARRY_SIZE bytes are unread.
+    bool fill(void);
+
+    // Everything buffered and not yet looked at, reading the next sector
+    // first if that is nothing, and steps over it. NULL at the end of the file.
+    uint8_t *read(uint16_t *count);
+
+    // Go back to the start of the file.
+    void rewind(void);
+
+    // File offset of the next unread byte, and carry on reading from one.
+    uint32_t position(void);
+    bool seek(uint32_t position);
+
+    // Read the next sector into the spare buffer, if it is empty, so that a
+    // later refill doesn't have to wait on the card. Call this while waiting
+    // on something else, the data already handed out is not touched.
+    void prefetch(void);
+
+    // The next line, terminated in place and without its '\n', and steps over
+    // it. A line that can't be carried over a refill in one piece is cut to
+    // FILE_READER_CARRY_SIZE and the rest dropped. NULL at the end of the file.
+    char *line(uint16_t *length);
+
+private:
+    bool skip_line(void);
+
+    SdFile *file;
+
+    // Index of the next unread byte and one past the last valid byte.
+    uint16_t start;
+    uint16_t end;
+
+    // Set while the tail of a line that was too long is still to be skipped.
+    bool discard;
+
+    // The buffer being read and the spare one being prefetched into, which
+    // swap on a refill. Bytes in the spare buffer, 0 if it is empty and -1
+    // once the end of the file has been reached.
+    uint8_t *buffer;
+    uint8_t *next;
+    int16_t next_count;
+
+    // One spare byte so the last line in the file can be terminated.
+    uint8_t buffers[2][FILE_READER_CARRY_SIZE + FILE_READER_SECTOR_SIZE + 1];
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include <stdint.h>
+#include "decb.h"
+
+// A print file's .idx sidecar is an IndexHeader followed by fixed size
+// entries, in file order, one at the start of every row and more every
+// INDEX_INTERVAL bytes within long rows. Each entry holds everything needed to
+// start printing from its offset. Rows begin after each X move.
+#define INDEX_MAGIC 0x58444941UL // "AIDX"
+#define INDEX_VERSION 1
+
+#define INDEX_INTERVAL 4096
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    // Size of the print file when it was indexed, to spot a stale index.
+    uint32_t file_size;
+    uint32_t entry_count;
+} IndexHeader;
+
+typedef struct {
+    uint32_t offset;     // First byte of the file not yet run
+    uint32_t column;     // Columns fired before offset
+    uint16_t row;        // X moves before offset
+    int32_t x_position;  // Steps from where the print started
+    int32_t y_position;
+    DecbState decoder;   // Only used for compressed files
+} IndexEntry;
+
+#endif
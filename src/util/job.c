@@ -0,0 +1,703 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "job.h"
+
+//#define JOB_TOOL
+
+int job_check_header(const JobHeader *header, uint32_t file_size)
+{
+    uint32_t size;
+
+    if (header->magic != JOB_MAGIC)
+        return JOB_NOT_A_JOB;
+
+    if (header->version != JOB_VERSION)
+        return JOB_BAD_VERSION;
+
+    // The firmware skips the header through a 64 byte carry buffer
+    if (header->header_size < sizeof(JobHeader) || header->header_size > 64)
+        return JOB_BAD_SIZE;
+
+    size = header->header_size +
+           header->move_count * JOB_MOVE_SIZE +
+           header->firing_count * FIRING_COLUMN_SIZE;
+
+    if (size != file_size)
+        return JOB_BAD_SIZE;
+
+    return JOB_OK;
+}
+
+uint32_t job_checksum(uint32_t hash, const uint8_t *data, uint16_t length)
+{
+    while (length--)
+        hash = ((hash << 5) + hash) + *data++;
+
+    return hash;
+}
+
+static void record(JobWriter *writer, const uint8_t *data, uint16_t length)
+{
+    writer->header.checksum = job_checksum(writer->header.checksum, data,
+                                           length);
+    writer->write(writer->context, data, length);
+}
+
+void job_writer_init(JobWriter *writer,
+                     void (*write)(void *context, const uint8_t *data,
+                                   uint16_t length),
+                     void *context)
+{
+    memset(writer, 0, sizeof(JobWriter));
+    writer->header.magic = JOB_MAGIC;
+    writer->header.version = JOB_VERSION;
+    writer->header.header_size = sizeof(JobHeader);
+    writer->header.checksum = JOB_CHECKSUM_START;
+    writer->write = write;
+    writer->context = context;
+
+    // Space for the header, written again once it is complete
+    write(context, (const uint8_t *)&writer->header, sizeof(JobHeader));
+}
+
+static void write_move(JobWriter *writer, char axis, long steps)
+{
+    JobHeader *header = &writer->header;
+    long *cur = axis == 'X' ? &writer->cur_x : &writer->cur_y;
+    uint32_t *extent = axis == 'X' ? &header->x_extent : &header->y_extent;
+    uint32_t *travel = axis == 'X' ? &header->x_travel : &header->y_travel;
+    uint8_t data[JOB_MOVE_SIZE];
+
+    job_writer_flush(writer);
+
+    data[0] = axis == 'X' ? JOB_MOVE_X : JOB_MOVE_Y;
+
+    if (steps == 0)
+    {
+        *travel += *cur < 0 ? -*cur : *cur;
+        *cur = 0;
+        data[1] = data[2] = 0;
+        record(writer, data, JOB_MOVE_SIZE);
+        header->move_count++;
+        return;
+    }
+
+    *travel += steps < 0 ? -steps : steps;
+    *cur += steps;
+    if (*cur > (long)*extent)
+        *extent = *cur;
+
+    // Long moves are split, a zero step record would mean go home
+    while (steps)
+    {
+        long part = steps > 32767 ? 32767 : steps < -32767 ? -32767 : steps;
+
+        data[1] = part & 0xFF;
+        data[2] = (part >> 8) & 0xFF;
+        record(writer, data, JOB_MOVE_SIZE);
+        header->move_count++;
+        steps -= part;
+    }
+}
+
+void job_write_move(JobWriter *writer, char axis, long steps)
+{
+    long cur = axis == 'X' ? writer->cur_x : writer->cur_y;
+    long delta = steps ? steps : -cur;
+
+    if (writer->estimate)
+        job_estimate_line(writer->estimate, axis == 'X' ? delta : 0,
+                          axis == 'Y' ? delta : 0);
+
+    write_move(writer, axis, steps);
+}
+
+static void write_move_to(JobWriter *writer, char axis, long position)
+{
+    long cur = axis == 'X' ? writer->cur_x : writer->cur_y;
+
+    if (position != cur)
+        write_move(writer, axis, position ? position - cur : 0);
+}
+
+void job_write_move_to(JobWriter *writer, long x, long y)
+{
+    if (writer->estimate)
+        job_estimate_line(writer->estimate, x - writer->cur_x,
+                          y - writer->cur_y);
+
+    write_move_to(writer, 'X', x);
+    write_move_to(writer, 'Y', y);
+}
+
+static void write_column(JobWriter *writer, const uint8_t *frame)
+{
+    uint8_t type = FIRING_COLUMN;
+
+    record(writer, &type, 1);
+    record(writer, frame, FIRING_COLUMN_SIZE - 1);
+    writer->header.firing_count++;
+}
+
+void job_write_column(JobWriter *writer, const uint8_t *frame)
+{
+    if (writer->estimate)
+        job_estimate_firing(writer->estimate, profile_column_addresses(frame),
+                            1);
+
+    job_writer_flush(writer);
+    write_column(writer, frame);
+}
+
+void job_writer_flush(JobWriter *writer)
+{
+    if (!writer->pending_addresses)
+        return;
+
+    write_column(writer, writer->pending);
+    memset(writer->pending, 0, sizeof(writer->pending));
+    writer->pending_addresses = 0;
+}
+
+// Put one side of a firing in the group for its address, or a new group. A
+// side already fired at that address has to wait for another column.
+static int merge_side(uint8_t *frame, uint8_t *addresses, uint8_t addr,
+                      int side, uint8_t prim)
+{
+    uint8_t i;
+    uint8_t *group;
+
+    if (!prim)
+        return 1;
+
+    for (i = 0, group = frame; i < *addresses; i++, group += 3)
+    {
+        if (group[0] == addr && !group[side])
+        {
+            group[side] = prim;
+            return 1;
+        }
+    }
+
+    if (*addresses == FIRING_ADDRESSES)
+        return 0;
+
+    group[0] = addr;
+    group[side] = prim;
+    (*addresses)++;
+    return 1;
+}
+
+static int merge_firing(uint8_t *frame, uint8_t *addresses, uint8_t r_prim,
+                        uint8_t r_addr, uint8_t l_prim, uint8_t l_addr)
+{
+    return merge_side(frame, addresses, r_addr, 1, r_prim) &&
+           merge_side(frame, addresses, l_addr, 2, l_prim);
+}
+
+void job_write_firing(JobWriter *writer, uint8_t r_prim, uint8_t r_addr,
+                      uint8_t l_prim, uint8_t l_addr)
+{
+    uint8_t frame[FIRING_COLUMN_SIZE - 1];
+    uint8_t addresses = writer->pending_addresses;
+
+    if (!r_prim && !l_prim)
+        return;
+
+    // Run as a single firing the first time, and only replayed as a column
+    if (writer->estimate)
+        job_estimate_firing(writer->estimate, 1, 0);
+
+    memcpy(frame, writer->pending, sizeof(frame));
+
+    if (!merge_firing(frame, &addresses, r_prim, r_addr, l_prim, l_addr))
+    {
+        job_writer_flush(writer);
+        memset(frame, 0, sizeof(frame));
+        addresses = 0;
+        merge_firing(frame, &addresses, r_prim, r_addr, l_prim, l_addr);
+    }
+
+    memcpy(writer->pending, frame, sizeof(frame));
+    writer->pending_addresses = addresses;
+}
+
+static uint8_t hexvalue(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'A' && ch <= 'F')
+        return ch - 'A' + 10;
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    return 0;
+}
+
+int job_parse_line(const char *line, JobLine *parsed)
+{
+    char *end;
+
+    if (line[0] == '#' || line[0] == '\r' || line[0] == 0)
+        return JOB_LINE_NONE;
+
+    // F and a hex address, right primitives and left primitives
+    if (line[0] == 'F' && strlen(line) >= 7)
+    {
+        parsed->r_addr = parsed->l_addr = hexvalue(line[2]);
+        parsed->r_prim = (hexvalue(line[3]) << 4) | hexvalue(line[4]);
+        parsed->l_prim = (hexvalue(line[5]) << 4) | hexvalue(line[6]);
+        return JOB_LINE_FIRE;
+    }
+
+    if (line[0] != 'M' || line[1] != ' ')
+        return JOB_LINE_UNKNOWN;
+
+    line += 2;
+
+    if (*line >= '0' && *line <= '9')
+    {
+        parsed->x = strtol(line, &end, 10);
+        parsed->y = strtol(end, &end, 10);
+
+        while (*end == ' ')
+            end++;
+        parsed->rest = end;
+        return JOB_LINE_MOVE_TO;
+    }
+
+    parsed->axis = toupper(line[0]);
+
+    if ((parsed->axis != 'X' && parsed->axis != 'Y') || line[1] != ' ')
+        return JOB_LINE_UNKNOWN;
+
+    parsed->x = atol(line + 2);
+    return JOB_LINE_MOVE;
+}
+
+void job_estimate_init(JobEstimate *estimate, float acceleration,
+                       uint16_t x_rate, uint16_t y_rate,
+                       uint16_t address_ticks)
+{
+    memset(estimate, 0, sizeof(JobEstimate));
+    estimate->acceleration = acceleration;
+    estimate->x_rate = x_rate;
+    estimate->y_rate = y_rate;
+    estimate->address_ticks = address_ticks;
+}
+
+static JobEstimateLine *estimate_line(JobEstimate *estimate, uint8_t i)
+{
+    return &estimate->lines[(estimate->first + i) % JOB_ESTIMATE_LINES];
+}
+
+// Count the oldest line, leaving at the given speed.
+static void estimate_retire(JobEstimate *estimate, float exit_sqr)
+{
+    JobEstimateLine *line = estimate_line(estimate, 0);
+
+    estimate->seconds += profile_seconds(line->length, estimate->acceleration,
+                                         line->entry_sqr, exit_sqr,
+                                         line->nominal_sqr);
+
+    // Whole seconds are moved out so the small ones still count
+    estimate->whole_seconds += (uint32_t)estimate->seconds;
+    estimate->seconds -= (uint32_t)estimate->seconds;
+
+    estimate->first = (estimate->first + 1) % JOB_ESTIMATE_LINES;
+    estimate->count--;
+}
+
+// As the planner, working back from the newest line which has to be able to
+// stop, then forward so each line can reach the next. The oldest line's entry
+// is fixed by the one run before it.
+static void estimate_replan(JobEstimate *estimate)
+{
+    float acceleration = estimate->acceleration;
+    float exit_sqr = profile_rest_speed_sqr(acceleration);
+    uint8_t i;
+
+    if (acceleration <= 0)
+        return;
+
+    for (i = estimate->count - 1; i > 0; i--)
+    {
+        JobEstimateLine *line = estimate_line(estimate, i);
+        float entry_sqr = exit_sqr + 2.0 * acceleration * line->length;
+
+        if (entry_sqr > line->max_entry_sqr)
+            entry_sqr = line->max_entry_sqr;
+
+        line->entry_sqr = exit_sqr = entry_sqr;
+    }
+
+    for (i = 0; i + 1 < estimate->count; i++)
+    {
+        JobEstimateLine *line = estimate_line(estimate, i);
+        JobEstimateLine *next = estimate_line(estimate, i + 1);
+        float reachable = line->entry_sqr + 2.0 * acceleration * line->length;
+
+        if (next->entry_sqr > reachable)
+            next->entry_sqr = reachable;
+    }
+}
+
+void job_estimate_line(JobEstimate *estimate, long x_steps, long y_steps)
+{
+    float x = labs(x_steps);
+    float y = labs(y_steps);
+    uint16_t feed = 0xFFFF;
+
+    if (x_steps == 0 && y_steps == 0)
+        return;
+
+    if (estimate->count == JOB_ESTIMATE_LINES)
+        estimate_retire(estimate, estimate_line(estimate, 1)->entry_sqr);
+
+    JobEstimateLine *line = estimate_line(estimate, estimate->count);
+
+    if (x_steps && estimate->x_rate < feed)
+        feed = estimate->x_rate;
+    if (y_steps && estimate->y_rate < feed)
+        feed = estimate->y_rate;
+
+    line->length = sqrt(x * x + y * y);
+    line->major = (x > y ? x : y) / line->length;
+    line->nominal_sqr = (float)feed * feed;
+    line->firing_ticks = 0;
+
+    float rest_sqr = profile_rest_speed_sqr(estimate->acceleration);
+
+    if (rest_sqr > line->nominal_sqr)
+        rest_sqr = line->nominal_sqr;
+
+    line->entry_sqr = line->max_entry_sqr = rest_sqr;
+
+    // Speed only carries through to a line heading exactly the same way
+    if (estimate->count > 0 &&
+        (x_steps < 0) == (estimate->last_x < 0) &&
+        (y_steps < 0) == (estimate->last_y < 0) &&
+        (int64_t)x_steps * estimate->last_y ==
+            (int64_t)y_steps * estimate->last_x)
+    {
+        float previous = estimate_line(estimate, estimate->count - 1)
+                             ->nominal_sqr;
+
+        line->max_entry_sqr = previous < line->nominal_sqr ?
+                                  previous : line->nominal_sqr;
+    }
+
+    estimate->last_x = x_steps;
+    estimate->last_y = y_steps;
+    estimate->count++;
+
+    estimate_replan(estimate);
+}
+
+void job_estimate_firing(JobEstimate *estimate, uint8_t addresses,
+                         uint8_t column)
+{
+    if (estimate->count == 0)
+        return;
+
+    JobEstimateLine *line = estimate_line(estimate, estimate->count - 1);
+    uint32_t ticks = line->firing_ticks ? line->firing_ticks
+                                        : PROFILE_STEP_TICKS;
+
+    ticks += profile_firing_ticks(estimate->address_ticks, addresses, column);
+    line->firing_ticks = ticks > 0xFFFF ? 0xFFFF : ticks;
+
+    float speed = profile_firing_rate(line->firing_ticks) / line->major;
+
+    if (speed * speed >= line->nominal_sqr)
+        return;
+
+    line->nominal_sqr = speed * speed;
+
+    if (line->max_entry_sqr > line->nominal_sqr)
+        line->max_entry_sqr = line->nominal_sqr;
+
+    estimate_replan(estimate);
+}
+
+uint32_t job_estimate_finish(JobEstimate *estimate)
+{
+    while (estimate->count > 1)
+        estimate_retire(estimate, estimate_line(estimate, 1)->entry_sqr);
+
+    if (estimate->count)
+        estimate_retire(estimate,
+                        profile_rest_speed_sqr(estimate->acceleration));
+
+    return estimate->whole_seconds + (uint32_t)(estimate->seconds + 0.5);
+}
+
+#ifdef JOB_TOOL
+// Compiles a print file, text moves with firing lines, decb() output or a .b
+// file, into a job, or just analyses it. Assumes a little endian host. Build
+// with: cc -DJOB_TOOL job.c decb.c profile.c -lm -o job
+static void write_file(void *context, const uint8_t *data, uint16_t length)
+{
+    fwrite(data, 1, length, (FILE *)context);
+}
+
+// decb() output for the whole of a .b file.
+static uint8_t *decode(uint8_t *in, long size, long *decoded_size)
+{
+    long room = size * 8 + 1024;
+    uint8_t *out = malloc(room);
+    int inoff = 0;
+    long outlen = 0;
+
+    decb_init();
+
+    for (;;)
+    {
+        int len = room - outlen > 32767 ? 32767 : room - outlen;
+        int res = decb((char *)in, &inoff, size, (char *)out + outlen, &len);
+
+        outlen += len;
+        if (res == DECODE_ERROR)
+        {
+            fprintf(stderr, "can't decode input file.\n");
+            exit(1);
+        }
+        if (res == NEED_MORE_DATA)
+            break;
+        if (room - outlen < 1024)
+        {
+            room *= 2;
+            out = realloc(out, room);
+        }
+    }
+
+    outlen += decb_finish((char *)out + outlen);
+    *decoded_size = outlen;
+    return out;
+}
+
+static void discard(void *context, const uint8_t *data, uint16_t length)
+{
+}
+
+// Address hold and pulse width in timer ticks, as cartridge_configure().
+static uint8_t ticks_from_ns(long ns)
+{
+    long ticks = (ns + 250) / 500;
+
+    return ticks < 1 ? 1 : ticks > 255 ? 255 : ticks;
+}
+
+int main(int argc, char **argv)
+{
+    char name[256];
+    int analyse = 0;
+    long speed = 1500;
+    long acceleration = 400;
+    long hold_ns = 500;
+    long pulse_ns = 6500;
+
+    while (argc > 2 && argv[1][0] == '-')
+    {
+        int used = 1;
+
+        if (!strcmp(argv[1], "-n"))
+            analyse = 1;
+        else if (!strcmp(argv[1], "-s") && argc > 3)
+            speed = atol(argv[2]), used = 2;
+        else if (!strcmp(argv[1], "-a") && argc > 3)
+            acceleration = atol(argv[2]), used = 2;
+        else if (!strcmp(argv[1], "-h") && argc > 3)
+            hold_ns = atol(argv[2]), used = 2;
+        else if (!strcmp(argv[1], "-p") && argc > 3)
+            pulse_ns = atol(argv[2]), used = 2;
+        else
+            break;
+        argv += used;
+        argc -= used;
+    }
+
+    if (argc < 2 || speed <= 0 || acceleration < 0)
+    {
+        printf("usage: job [-n] [-s mm/min] [-a mm/s^2] [-h hold ns]\n"
+               "           [-p pulse ns] <print file>\n"
+               "  compiles a print file or .b file to a .job file, -n only\n"
+               "  analyses it. Speed defaults to 1500 mm/min, acceleration to\n"
+               "  400 mm/s^2 (0 for none), and the address hold and pulse\n"
+               "  width to 500 and 6500 ns, the printer defaults.\n");
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "can't open input file.\n");
+        return 1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *in = malloc(size + 1);
+    if (in == NULL || fread(in, 1, size, f) != (size_t)size)
+    {
+        fclose(f);
+        fprintf(stderr, "can't read input file.\n");
+        return 1;
+    }
+    fclose(f);
+
+    JobWriter writer;
+    JobHeader *header = &writer.header;
+    JobEstimate estimate;
+    FILE *fout = NULL;
+    long pos = 0;
+
+    if (size >= (long)sizeof(JobHeader) &&
+        ((JobHeader *)in)->magic == JOB_MAGIC)
+    {
+        // Already compiled, just report it
+        int check = job_check_header((JobHeader *)in, size);
+
+        if (check != JOB_OK)
+        {
+            fprintf(stderr, "bad job header (%d).\n", check);
+            return 1;
+        }
+        // Walked through a writer that discards it, for the estimate
+        pos = ((JobHeader *)in)->header_size;
+        job_writer_init(&writer, discard, NULL);
+        analyse = 1;
+    }
+    else
+    {
+        // A last line without a newline still counts
+        if (size > 0 && in[size - 1] != '\n')
+            in[size++] = '\n';
+
+        int len = strlen(argv[1]);
+        if (len > 2 && argv[1][len - 2] == '.' && argv[1][len - 1] == 'b')
+            in = decode(in, size, &size);
+
+        in = realloc(in, size + 1);
+        in[size] = '\n';
+
+        if (!analyse)
+        {
+            snprintf(name, sizeof(name) - 4, "%s", argv[1]);
+            if (strrchr(name, '.'))
+                *strrchr(name, '.') = 0;
+            strcat(name, ".job");
+
+            fout = fopen(name, "wb");
+            if (fout == NULL)
+            {
+                fprintf(stderr, "can't open output file.\n");
+                return 1;
+            }
+        }
+
+        job_writer_init(&writer, fout ? write_file : discard, fout);
+    }
+
+    // Steps per mm as in Stepper
+    long rate = speed * 80 / 60;
+
+    job_estimate_init(&estimate, acceleration * 80.0, rate, rate,
+                      profile_address_ticks(ticks_from_ns(hold_ns),
+                                            ticks_from_ns(pulse_ns)));
+    writer.estimate = &estimate;
+
+    int compiled = pos > 0;
+    int lineno = 0;
+    while (pos < size)
+    {
+        uint8_t *p = in + pos;
+
+        if (p[0] == FIRING_COLUMN)
+        {
+            if (pos + FIRING_COLUMN_SIZE > size)
+                break;
+            job_write_column(&writer, p + 1);
+            pos += FIRING_COLUMN_SIZE;
+            continue;
+        }
+
+        if (compiled)
+        {
+            if ((p[0] != JOB_MOVE_X && p[0] != JOB_MOVE_Y) ||
+                pos + JOB_MOVE_SIZE > size)
+                break;
+            job_write_move(&writer, p[0] == JOB_MOVE_X ? 'X' : 'Y',
+                           (int16_t)(p[1] | (p[2] << 8)));
+            pos += JOB_MOVE_SIZE;
+            continue;
+        }
+
+        if (p[0] == 0x01)
+        {
+            if (pos + 8 > size)
+                break;
+            job_write_firing(&writer, p[1], p[2], p[5], p[6]);
+            pos += 8;
+            continue;
+        }
+
+        uint8_t *end = memchr(p, '\n', size + 1 - pos);
+        *end = 0;
+        lineno++;
+
+        JobLine line;
+
+        switch (job_parse_line((char *)p, &line))
+        {
+        case JOB_LINE_MOVE:
+            job_write_move(&writer, line.axis, line.x);
+            break;
+        case JOB_LINE_MOVE_TO:
+            job_write_move_to(&writer, line.x, line.y);
+            break;
+        case JOB_LINE_FIRE:
+            job_write_firing(&writer, line.r_prim, line.r_addr, line.l_prim,
+                             line.l_addr);
+            break;
+        case JOB_LINE_UNKNOWN:
+            fprintf(stderr, "dropping line %d:%s\n", lineno, (char *)p);
+            break;
+        }
+
+        pos = end - in + 1;
+    }
+
+    job_writer_flush(&writer);
+
+    if (pos < size)
+        fprintf(stderr, "stopped at a bad record at %ld.\n", pos);
+
+    if (fout)
+    {
+        fseek(fout, 0, SEEK_SET);
+        fwrite(header, 1, sizeof(JobHeader), fout);
+        fclose(fout);
+        printf("wrote %s\n", name);
+    }
+
+    uint32_t seconds = job_estimate_finish(&estimate);
+
+    printf("extents: %lu x %lu steps\n"
+           "moves: %lu, travel: %lu x %lu steps\n"
+           "columns: %lu\n"
+           "estimated time: %lu min %lu s\n",
+           (unsigned long)header->x_extent, (unsigned long)header->y_extent,
+           (unsigned long)header->move_count,
+           (unsigned long)header->x_travel, (unsigned long)header->y_travel,
+           (unsigned long)header->firing_count,
+           (unsigned long)seconds / 60, (unsigned long)seconds % 60);
+
+    return 0;
+}
+#endif
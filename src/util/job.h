@@ -0,0 +1,158 @@
+#ifndef _JOB_H_
+#define _JOB_H_
+
+#include <stdint.h>
+#include "decb.h"
+#include "profile.h"
+
+// A compiled print job is a JobHeader followed by fixed width records, all
+// little endian. Moves are JOB_MOVE_SIZE bytes, JOB_MOVE_X or JOB_MOVE_Y then
+// a signed 16 bit step count where 0 returns the axis to zero, as for M lines.
+// Firings are FIRING_COLUMN frames, as written by decb().
+#define JOB_MAGIC 0x424A4741UL // "AGJB"
+#define JOB_VERSION 1
+
+#define JOB_MOVE_X 0x10
+#define JOB_MOVE_Y 0x11
+#define JOB_MOVE_SIZE 3
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    // Records start here, newer versions may add fields before them.
+    uint16_t header_size;
+    // Furthest position reached on each axis, in steps.
+    uint32_t x_extent;
+    uint32_t y_extent;
+    // Total steps moved on each axis, for estimating the print time.
+    uint32_t x_travel;
+    uint32_t y_travel;
+    uint32_t move_count;
+    uint32_t firing_count;
+    // djb2 of everything after the header.
+    uint32_t checksum;
+} JobHeader;
+
+#define JOB_CHECKSUM_START 5381UL
+
+#define JOB_OK 0
+#define JOB_NOT_A_JOB 1
+#define JOB_BAD_VERSION 2
+#define JOB_BAD_SIZE 3
+#define JOB_BAD_CHECKSUM 4
+
+// Checks the header against the size of the file it came from.
+int job_check_header(const JobHeader *header, uint32_t file_size);
+
+uint32_t job_checksum(uint32_t hash, const uint8_t *data, uint16_t length);
+
+// A line of a text print file, as the firmware runs it and the host tool
+// compiles it.
+#define JOB_LINE_NONE 0    // Blank, or a comment
+#define JOB_LINE_MOVE 1    // M X steps or M Y steps, 0 returns the axis to zero
+#define JOB_LINE_MOVE_TO 2 // M x y, an absolute position in steps
+#define JOB_LINE_FIRE 3    // F and an address with right and left primitives
+#define JOB_LINE_UNKNOWN 4
+
+typedef struct {
+    char axis;          // 'X' or 'Y', for a move
+    long x;             // Steps for a move, or the position to move to
+    long y;
+    uint8_t r_prim;
+    uint8_t r_addr;
+    uint8_t l_prim;
+    uint8_t l_addr;
+    const char *rest;   // What follows the position of a move to
+} JobLine;
+
+// Returns one of the JOB_LINE_ types, filling in the fields it uses.
+int job_parse_line(const char *line, JobLine *parsed);
+
+// Works the time a print takes out from its lines and firings as they are
+// made, the way the motion planner would run them. It looks ahead over as many
+// lines as the motion queue holds, carries speed between lines going the same
+// way and slows lines down to leave time for their firings.
+#define JOB_ESTIMATE_LINES 16
+
+typedef struct {
+    float length;        // Steps along the path
+    float major;         // Major axis steps per step of path
+    float nominal_sqr;   // Squared path speeds, in steps per second
+    float max_entry_sqr;
+    float entry_sqr;
+    uint16_t firing_ticks; // Time the firings at its end take, 0 for none
+} JobEstimateLine;
+
+typedef struct {
+    float acceleration;  // Steps per second squared along the path, 0 for none
+    uint16_t x_rate;     // Steps per second
+    uint16_t y_rate;
+    uint16_t address_ticks; // As profile_address_ticks()
+
+    // Lines planned but not yet counted, oldest first
+    JobEstimateLine lines[JOB_ESTIMATE_LINES];
+    uint8_t first;
+    uint8_t count;
+    long last_x;
+    long last_y;
+
+    uint32_t whole_seconds;
+    float seconds;
+} JobEstimate;
+
+void job_estimate_init(JobEstimate *estimate, float acceleration,
+                       uint16_t x_rate, uint16_t y_rate,
+                       uint16_t address_ticks);
+
+// A straight line moving each axis by the given steps.
+void job_estimate_line(JobEstimate *estimate, long x_steps, long y_steps);
+
+// Firings at the end of the last line, as profile_firing_ticks() takes them.
+void job_estimate_firing(JobEstimate *estimate, uint8_t addresses,
+                         uint8_t column);
+
+// Counts the lines still planned, each coming to rest at the end, and returns
+// the total in seconds.
+uint32_t job_estimate_finish(JobEstimate *estimate);
+
+// Compiles moves and firings into a job as they are made, following the
+// extents and checksum. Everything goes out through write(), starting with
+// space for the header, which is only complete once job_writer_flush() has
+// been called after the last record.
+typedef struct {
+    JobHeader header;
+    long cur_x;
+    long cur_y;
+    void (*write)(void *context, const uint8_t *data, uint16_t length);
+    void *context;
+    // Single firings since the last record, merged into one column
+    uint8_t pending[FIRING_COLUMN_SIZE - 1];
+    uint8_t pending_addresses;
+    // If set, follows every line and firing written
+    JobEstimate *estimate;
+} JobWriter;
+
+void job_writer_init(JobWriter *writer,
+                     void (*write)(void *context, const uint8_t *data,
+                                   uint16_t length),
+                     void *context);
+
+// As M lines, a move of zero returns the axis to zero.
+void job_write_move(JobWriter *writer, char axis, long steps);
+
+// An absolute move of both axes, as the M x y line, written as a move for each
+// axis that has somewhere to go.
+void job_write_move_to(JobWriter *writer, long x, long y);
+
+// A column frame without its FIRING_COLUMN byte, as fire_column() takes it.
+void job_write_column(JobWriter *writer, const uint8_t *frame);
+
+// As motion_fire(). Firings with nothing between them go off on the same
+// step, so they are merged into one column while the addresses allow.
+void job_write_firing(JobWriter *writer, uint8_t r_prim, uint8_t r_addr,
+                      uint8_t l_prim, uint8_t l_addr);
+
+// Write out the column still being merged, if any.
+void job_writer_flush(JobWriter *writer);
+
+#endif
@@ -33,25 +33,7 @@ void limit_initialise(void) {
 bool limit_switch_nc = true;
 
 uint8_t limit_switches(void) {
-    uint8_t switches = 0b00000000;
-
-    if(limit_x_positive()) {
-        switches |= X_POS_BIT;
-    }
-
-    if(limit_x_negative()) {
-        switches |= X_NEG_BIT;
-    }
-
-    if(limit_y_positive()) {
-        switches |= Y_POS_BIT;
-    }
-
-    if(limit_y_negative()) {
-        switches |= Y_NEG_BIT;
-    }
-
-    return switches;
+    return limit_read();
 }
 
 bool limit_x_positive(void) {
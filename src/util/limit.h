@@ -2,6 +2,7 @@
 #define _LIMIT_H_
 
 #include <stdint.h>
+#include <avr/io.h>
 
 #define X_POS_HARDWARE_BIT 0b00001000
 #define X_NEG_HARDWARE_BIT 0b00000001
@@ -45,6 +46,35 @@ private:
 
 extern bool limit_switch_nc;
 
+// All four switches as a bitmask of the *_BIT values, read straight from the
+// pins. None of the limit pins can raise a pin change interrupt on the 2560,
+// so the step interrupt calls this once per tick instead.
+inline uint8_t limit_read(void) {
+    uint8_t switches = 0b00000000;
+
+    if(PINE & X_POS_HARDWARE_BIT) {
+        switches |= X_POS_BIT;
+    }
+
+    if(PINF & X_NEG_HARDWARE_BIT) {
+        switches |= X_NEG_BIT;
+    }
+
+    if(PINF & Y_POS_HARDWARE_BIT) {
+        switches |= Y_POS_BIT;
+    }
+
+    if(PINH & Y_NEG_HARDWARE_BIT) {
+        switches |= Y_NEG_BIT;
+    }
+
+    if(limit_switch_nc) {
+        switches ^= (X_MASK | Y_MASK);
+    }
+
+    return switches;
+}
+
 void limit_initialise(void);
 
 uint8_t limit_switches(void);
@@ -0,0 +1,873 @@
+#include "motion.h"
+
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "axis.h"
+#include "cartridge.h"
+#include "settings.h"
+#include "../argentum/argentum.h"
+
+extern "C" {
+#include "profile.h"
+}
+
+// Step intervals for evenly spaced rates, worked out by the compiler.
+#define INTERVAL_ENTRY(i) (uint16_t)(MOTION_TICKS_PER_SECOND \
+        / (MOTION_TABLE_FIRST_RATE + (uint32_t)(i) * MOTION_TABLE_STEP))
+#define INTERVAL_ENTRIES_4(i) INTERVAL_ENTRY(i), INTERVAL_ENTRY(i + 1), \
+        INTERVAL_ENTRY(i + 2), INTERVAL_ENTRY(i + 3)
+#define INTERVAL_ENTRIES_16(i) INTERVAL_ENTRIES_4(i), INTERVAL_ENTRIES_4(i + 4), \
+        INTERVAL_ENTRIES_4(i + 8), INTERVAL_ENTRIES_4(i + 12)
+#define INTERVAL_ENTRIES_64(i) INTERVAL_ENTRIES_16(i), \
+        INTERVAL_ENTRIES_16(i + 16), INTERVAL_ENTRIES_16(i + 32), \
+        INTERVAL_ENTRIES_16(i + 48)
+
+static const uint16_t interval_table[MOTION_TABLE_SIZE] PROGMEM = {
+    INTERVAL_ENTRIES_64(0),
+    INTERVAL_ENTRIES_64(64),
+    INTERVAL_ENTRIES_64(128),
+    INTERVAL_ENTRIES_64(192),
+    INTERVAL_ENTRY(256)
+};
+
+uint16_t motion_interval(uint16_t steps_per_second) {
+    if(steps_per_second < MOTION_TABLE_FIRST_RATE) {
+        // Slow enough that there is time for the division
+        if(steps_per_second <= (MOTION_TICKS_PER_SECOND >> 16)) {
+            return 0xFFFF;
+        }
+
+        return MOTION_TICKS_PER_SECOND / steps_per_second;
+    }
+
+    if(steps_per_second > MOTION_TABLE_LAST_RATE) {
+        steps_per_second = MOTION_TABLE_LAST_RATE;
+    }
+
+    uint16_t offset = steps_per_second - MOTION_TABLE_FIRST_RATE;
+    uint8_t index = offset / MOTION_TABLE_STEP;
+    uint8_t fraction = offset % MOTION_TABLE_STEP;
+
+    uint16_t interval = pgm_read_word(&interval_table[index]);
+    uint16_t next = pgm_read_word(&interval_table[index + 1]);
+
+    // Neighbouring entries are at most ~900 ticks apart, so this stays in 16
+    // bits.
+    return interval - (uint16_t)((interval - next) * fraction) / MOTION_TABLE_STEP;
+}
+
+// Where a line stops accelerating and starts decelerating, and the speeds it
+// starts and finishes at. Steps and rates refer to the major axis.
+struct MotionProfile {
+    uint16_t accelerate_until;
+    uint16_t decelerate_after;
+
+    uint16_t initial_rate;
+    uint16_t final_rate;
+    uint16_t nominal_rate;
+};
+
+// Lines waiting to be run, or running. The foreground adds blocks at the head
+// and the step interrupt retires them from the tail.
+struct MotionBlock {
+    uint16_t x_steps;
+    uint16_t y_steps;
+    uint16_t step_events;
+
+    uint8_t x_direction;
+    uint8_t y_direction;
+
+    // Read by the step interrupt, only replaced atomically once queued
+    MotionProfile profile;
+
+    // Steps per second of the major axis, only read by the interrupt through
+    // the profile
+    uint16_t nominal_rate;
+
+    // Rate gained per timer tick, in steps per second as 16.16 fixed point
+    uint32_t acceleration;
+
+    // Planner state, in steps and squared steps per second along the path,
+    // so that looking ahead needs no square roots
+    float length;
+    float major;                 // Major axis steps per step of path
+    float acceleration_distance; // Speed squared gained over the whole line
+    float nominal_speed_sqr;
+    float max_entry_speed_sqr;
+    float entry_speed_sqr;
+};
+
+static MotionBlock blocks[MOTION_BUFFER_SIZE];
+static volatile uint8_t block_head = 0;
+static volatile uint8_t block_tail = 0;
+
+// Incremented whenever the interrupt discards the queue after hitting a limit,
+// so a block planned across the discard can be dropped too.
+static volatile uint8_t discard_count = 0;
+
+static volatile bool active = false;
+
+// Head firings waiting for the carriage to reach a step of a queued block. The
+// foreground adds them at the head and the step interrupt fires them from the
+// tail, in order.
+struct MotionFiring {
+    uint8_t block;
+    uint16_t step;
+
+    // Fire the next queued column frame instead of the single address below
+    bool column;
+
+    uint8_t r_prim;
+    uint8_t r_addr;
+    uint8_t l_prim;
+    uint8_t l_addr;
+};
+
+static MotionFiring firings[MOTION_FIRING_BUFFER_SIZE];
+static volatile uint8_t firing_head = 0;
+static volatile uint8_t firing_tail = 0;
+
+// Frames for the column firings, used in the same order as the firings.
+static uint8_t columns[MOTION_COLUMN_BUFFER_SIZE][FIRING_COLUMN_SIZE - 1];
+static volatile uint8_t column_head = 0;
+static volatile uint8_t column_tail = 0;
+
+// Firings due on the same step all go off before the next step, so the time
+// they take is added up as they are queued.
+static uint8_t same_step_block;
+static uint16_t same_step;
+static uint32_t same_step_ticks = 0;
+
+// Set while firings due on the last step are still waiting. A column keeps
+// the interrupt busy for up to ~180 us, longer than a byte takes to arrive at
+// 115200 baud, so each one after the first is fired from a pass of its own
+// without stepping and the serial interrupt gets a look in between.
+static bool firing_behind = false;
+
+// Match for the step the waiting firings belong to, the next step is timed
+// from it.
+static uint16_t behind_match;
+
+// The line in progress. The axis with the most steps to travel (the major
+// axis) steps on every interrupt and the other follows using Bresenham's
+// algorithm, so both arrive at the same time along a straight path.
+static MotionBlock *block;
+static int32_t x_error;
+static int32_t y_error;
+static uint16_t step_count;
+
+// Rate of the major axis in steps per second as 16.16 fixed point.
+static uint32_t step_rate;
+static uint16_t step_interval;
+
+static inline uint8_t next_block_index(uint8_t index) {
+    return (index + 1) & (MOTION_BUFFER_SIZE - 1);
+}
+
+static inline uint8_t next_firing_index(uint8_t index) {
+    return (index + 1) & (MOTION_FIRING_BUFFER_SIZE - 1);
+}
+
+static inline uint8_t next_column_index(uint8_t index) {
+    return (index + 1) & (MOTION_COLUMN_BUFFER_SIZE - 1);
+}
+
+void motion_initialise(void) {
+    // The Arduino core sets timer 1 up for 8-bit phase correct PWM, replace
+    // that with a free-running normal mode counter.
+    TIMSK1 = 0;
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11);
+    TCCR1C = 0;
+    TCNT1 = 0;
+}
+
+static inline uint8_t previous_block_index(uint8_t index) {
+    return (index - 1) & (MOTION_BUFFER_SIZE - 1);
+}
+
+// Acceleration along the path in steps per second squared, zero if disabled.
+static float path_acceleration(void) {
+    return (float)global_settings.motionOptions.acceleration
+            * Axis::steps_per_mm;
+}
+
+// Work out the trapezoidal speed profile for a line entered and exited at the
+// given squared path speeds. Lines too short to reach full speed accelerate up
+// to the point where they need to start decelerating.
+static void calculate_profile(MotionBlock *line,
+                              float acceleration,
+                              float entry_sqr,
+                              float exit_sqr,
+                              MotionProfile *profile) {
+    if(acceleration <= 0) {
+        profile->accelerate_until = 0;
+        profile->decelerate_after = line->step_events;
+        profile->initial_rate = line->nominal_rate;
+        profile->final_rate = line->nominal_rate;
+        profile->nominal_rate = line->nominal_rate;
+
+        return;
+    }
+
+    float nominal_sqr = line->nominal_speed_sqr;
+
+    entry_sqr = min(entry_sqr, nominal_sqr);
+    exit_sqr = min(exit_sqr, nominal_sqr);
+
+    float accelerate_distance;
+    float decelerate_distance;
+
+    profile_trapezoid(line->length, acceleration, entry_sqr, exit_sqr,
+            nominal_sqr, &accelerate_distance, &decelerate_distance);
+
+    // Scale path distances and speeds down to the major axis.
+    uint16_t accelerate_steps = accelerate_distance * line->major;
+    uint16_t decelerate_steps = decelerate_distance * line->major;
+
+    accelerate_steps = min(accelerate_steps, line->step_events);
+    decelerate_steps = min(decelerate_steps,
+                           line->step_events - accelerate_steps);
+
+    profile->accelerate_until = accelerate_steps;
+    profile->decelerate_after = line->step_events - decelerate_steps;
+    profile->initial_rate = min(sqrt(entry_sqr) * line->major,
+                                line->nominal_rate);
+    profile->final_rate = min(sqrt(exit_sqr) * line->major,
+                              line->nominal_rate);
+    profile->nominal_rate = line->nominal_rate;
+}
+
+// True while a queued line hasn't been started by the interrupt. Call with
+// interrupts off.
+static bool block_waiting(uint8_t index) {
+    uint8_t position = (index - block_tail) & (MOTION_BUFFER_SIZE - 1);
+    uint8_t queued = (block_head - block_tail) & (MOTION_BUFFER_SIZE - 1);
+
+    return position < queued && (position > 0 || !active);
+}
+
+// Look ahead over the queued lines and raise the speed at each junction as
+// far as the lines either side of it allow, then recalculate their profiles.
+// The line being run cannot be changed, so its exit speed is fixed.
+//
+// Working back from the newest line stops at the first one whose entry speed
+// doesn't change, everything before it is already planned. The newest line's
+// profile can be worked out again anyway, if it has been slowed down. If the interrupt
+// starts one of the lines in the meantime, the plan is kept for the lines
+// still waiting, which carry on from the speed the running one leaves at.
+static void recalculate(bool replan_newest) {
+    float acceleration = path_acceleration();
+
+    if(acceleration <= 0) {
+        return;
+    }
+
+    float rest_sqr = profile_rest_speed_sqr(acceleration);
+
+    float entry_sqr[MOTION_BUFFER_SIZE];
+    MotionProfile profiles[MOTION_BUFFER_SIZE];
+
+    uint8_t first;
+    uint8_t newest = previous_block_index(block_head);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if(block_tail == block_head) {
+            return;
+        }
+
+        first = active ? next_block_index(block_tail) : block_tail;
+    }
+
+    if(first == block_head) {
+        return;
+    }
+
+    // Reverse pass, the newest line has to be able to stop. The first line's
+    // entry is fixed by the line before it, or is from rest.
+    uint8_t start = first;
+    float exit_sqr = rest_sqr;
+
+    for(uint8_t i = newest; i != first; i = previous_block_index(i)) {
+        MotionBlock *line = &blocks[i];
+
+        float entry = min(line->max_entry_speed_sqr,
+                exit_sqr + line->acceleration_distance);
+
+        if(entry == line->entry_speed_sqr
+                && !(i == newest && replan_newest)) {
+            start = i;
+            break;
+        }
+
+        entry_sqr[i] = entry;
+        exit_sqr = entry;
+    }
+
+    // Nothing changed, the newest line keeps the profile it was queued with
+    if(start == newest && !replan_newest) {
+        return;
+    }
+
+    entry_sqr[start] = blocks[start].entry_speed_sqr;
+
+    for(;;) {
+        // Forward pass, make sure each line can accelerate up to the next.
+        for(uint8_t i = start; i != newest; i = next_block_index(i)) {
+            float reachable = entry_sqr[i] + blocks[i].acceleration_distance;
+            uint8_t next = next_block_index(i);
+
+            if(entry_sqr[next] > reachable) {
+                entry_sqr[next] = reachable;
+            }
+        }
+
+        for(uint8_t i = start; ; i = next_block_index(i)) {
+            float exit = (i == newest) ? rest_sqr
+                    : entry_sqr[next_block_index(i)];
+
+            calculate_profile(&blocks[i], acceleration, entry_sqr[i], exit,
+                    &profiles[i]);
+
+            if(i == newest) {
+                break;
+            }
+        }
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if(block_waiting(start)) {
+                for(uint8_t i = start; ; i = next_block_index(i)) {
+                    blocks[i].entry_speed_sqr = entry_sqr[i];
+                    blocks[i].profile = profiles[i];
+
+                    if(i == newest) {
+                        break;
+                    }
+                }
+
+                return;
+            }
+
+            // The start line, and maybe more, has been started with the
+            // profile it had, so the next one is entered as that planned.
+            if(!active || next_block_index(block_tail) == block_head) {
+                return;
+            }
+
+            start = next_block_index(block_tail);
+        }
+
+        entry_sqr[start] = blocks[start].entry_speed_sqr;
+    }
+}
+
+// Set up the interrupt state for the block at the tail of the queue.
+static void load_block(void) {
+    block = &blocks[block_tail];
+
+    x_axis.set_direction(block->x_direction);
+    y_axis.set_direction(block->y_direction);
+
+    x_error = -(int32_t)(block->step_events >> 1);
+    y_error = x_error;
+
+    step_count = 0;
+    step_rate = (uint32_t)block->profile.initial_rate << 16;
+    step_interval = motion_interval(block->profile.initial_rate);
+}
+
+static void (*idle_function)(void) = NULL;
+
+void motion_set_idle(void (*idle)(void)) {
+    idle_function = idle;
+}
+
+// Axis::run() is called while waiting so that limit holds are reported.
+static void wait_idle(void) {
+    x_axis.run();
+    y_axis.run();
+
+    if(idle_function) {
+        idle_function();
+    }
+}
+
+// Set by motion_hold() for the next line. Once that line is written at the
+// head of the queue it stays there, out of sight of the interrupt, until it is
+// released.
+static bool hold_next = false;
+static bool holding = false;
+static uint8_t held_discards;
+
+// Hand the line at the head of the queue to the interrupt, unless a limit
+// switch emptied the queue after its starting point was taken.
+static void queue_block(uint8_t discards) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // A limit switch emptied the queue while this line was being planned,
+        // so its starting point no longer holds.
+        if(discards != discard_count) {
+            x_axis.hold();
+            y_axis.hold();
+
+            return;
+        }
+
+        block_head = next_block_index(block_head);
+
+        if(!active) {
+            active = true;
+
+            load_block();
+
+            OCR1A = TCNT1 + MOTION_START_TICKS;
+
+            // Discard any stale match before enabling the interrupt
+            TIFR1 = _BV(OCF1A);
+            TIMSK1 |= _BV(OCIE1A);
+        }
+    }
+
+    recalculate(false);
+}
+
+void motion_hold(void) {
+    hold_next = true;
+}
+
+void motion_release(void) {
+    if(holding) {
+        holding = false;
+        queue_block(held_discards);
+    }
+}
+
+void motion_move_to(uint32_t x, uint32_t y) {
+    bool hold = hold_next;
+
+    hold_next = false;
+    motion_release();
+
+    // Wait for room in the queue
+    while(next_block_index(block_head) == block_tail) {
+        wait_idle();
+    }
+
+    MotionBlock *line = &blocks[block_head];
+
+    uint8_t discards = discard_count;
+
+    same_step_ticks = 0;
+
+    int32_t x_delta = x_axis.set_goal(x);
+    int32_t y_delta = y_axis.set_goal(y);
+
+    line->x_direction = (x_delta < 0) ? Axis::Negative : Axis::Positive;
+    line->y_direction = (y_delta < 0) ? Axis::Negative : Axis::Positive;
+
+    line->x_steps = abs(x_delta);
+    line->y_steps = abs(y_delta);
+    line->step_events = max(line->x_steps, line->y_steps);
+
+    if(line->step_events == 0) {
+        return;
+    }
+
+    line->length = sqrt((float)line->x_steps * line->x_steps
+            + (float)line->y_steps * line->y_steps);
+    line->major = line->step_events / line->length;
+
+    // The path speed is that of the slower moving axis.
+    uint16_t feed = 0xFFFF;
+
+    if(line->x_steps) {
+        feed = min(feed, x_axis.get_motor()->get_step_rate());
+    }
+
+    if(line->y_steps) {
+        feed = min(feed, y_axis.get_motor()->get_step_rate());
+    }
+
+    float acceleration = path_acceleration();
+    float nominal_sqr = (float)feed * feed;
+    float rest_sqr = min(profile_rest_speed_sqr(acceleration), nominal_sqr);
+
+    line->nominal_speed_sqr = nominal_sqr;
+    line->nominal_rate = feed * line->major;
+    line->acceleration = (acceleration * line->major * 65536.0)
+            / MOTION_TICKS_PER_SECOND;
+    line->acceleration_distance = 2.0 * acceleration * line->length;
+
+    // Only carry speed through a junction with a line heading in exactly the
+    // same direction, anything else has to come to rest first.
+    line->max_entry_speed_sqr = rest_sqr;
+
+    if(block_head != block_tail) {
+        MotionBlock *previous = &blocks[previous_block_index(block_head)];
+
+        if(previous->x_direction == line->x_direction
+                && previous->y_direction == line->y_direction
+                && (uint32_t)previous->x_steps * line->y_steps
+                        == (uint32_t)previous->y_steps * line->x_steps) {
+            line->max_entry_speed_sqr = min(previous->nominal_speed_sqr,
+                    line->nominal_speed_sqr);
+        }
+    }
+
+    // Until the planner has looked at it, the line starts and stops at rest,
+    // which is always safe to run.
+    line->entry_speed_sqr = rest_sqr;
+    calculate_profile(line, acceleration, rest_sqr, rest_sqr, &line->profile);
+
+    if(hold) {
+        holding = true;
+        held_discards = discards;
+
+        return;
+    }
+
+    queue_block(discards);
+}
+
+static void wait_for_firing_room(bool column) {
+    while(next_firing_index(firing_head) == firing_tail
+            || (column && next_column_index(column_head) == column_tail)) {
+        // Only the interrupt makes room, so a held line has to go
+        motion_release();
+
+        wait_idle();
+    }
+}
+
+// Slow a line that hasn't been started so that each step leaves time for the
+// firings due on it.
+static void limit_firing_rate(uint8_t index, uint16_t step, uint8_t addresses,
+                              bool column) {
+    uint32_t ticks = profile_firing_ticks(cartridge_address_ticks(),
+                                          addresses, column);
+
+    if(same_step_ticks > 0 && index == same_step_block && step == same_step) {
+        same_step_ticks += ticks;
+    } else {
+        same_step_block = index;
+        same_step = step;
+        same_step_ticks = ticks + PROFILE_STEP_TICKS;
+    }
+
+    uint16_t rate = profile_firing_rate(same_step_ticks);
+
+    MotionBlock *line = &blocks[index];
+
+    if(rate >= line->nominal_rate) {
+        return;
+    }
+
+    bool waiting;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        waiting = block_waiting(index);
+    }
+
+    // The interrupt only picks up a new nominal rate with a new profile
+    if(!holding && !waiting) {
+        return;
+    }
+
+    float speed = rate / line->major;
+
+    line->nominal_rate = rate;
+    line->nominal_speed_sqr = speed * speed;
+    line->max_entry_speed_sqr = min(line->max_entry_speed_sqr,
+                                    line->nominal_speed_sqr);
+
+    if(holding) {
+        // Out of sight of the interrupt, and still planned from rest to rest
+        calculate_profile(line, path_acceleration(), line->entry_speed_sqr,
+                line->entry_speed_sqr, &line->profile);
+    } else {
+        recalculate(true);
+    }
+}
+
+// Attach a firing to the last queued block, or the held one. Returns false if
+// nothing is queued, in which case the caller should fire straight away.
+static bool queue_firing(const MotionFiring *firing, uint16_t step,
+                         uint8_t addresses) {
+    bool queued = false;
+    uint8_t index;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // While the interrupt is active the last queued block has not been
+        // retired, so it is safe to attach to. A held block can't have been
+        // started.
+        if(active || holding) {
+            index = holding ? block_head : previous_block_index(block_head);
+            step = min(step, blocks[index].step_events);
+
+            MotionFiring *queued_firing = &firings[firing_head];
+
+            *queued_firing = *firing;
+            queued_firing->block = index;
+            queued_firing->step = step;
+
+            if(firing->column) {
+                column_head = next_column_index(column_head);
+            }
+
+            firing_head = next_firing_index(firing_head);
+
+            queued = true;
+        }
+    }
+
+    if(queued) {
+        limit_firing_rate(index, step, addresses, firing->column);
+    }
+
+    return queued;
+}
+
+void motion_fire_at(uint16_t step, uint8_t r_prim, uint8_t r_addr,
+                    uint8_t l_prim, uint8_t l_addr) {
+    wait_for_firing_room(false);
+
+    MotionFiring firing;
+
+    firing.column = false;
+    firing.r_prim = r_prim;
+    firing.r_addr = r_addr;
+    firing.l_prim = l_prim;
+    firing.l_addr = l_addr;
+
+    // Nothing to wait for, the carriage is already there
+    if(!queue_firing(&firing, step, 1)) {
+        fire_head(r_prim, r_addr, l_prim, l_addr);
+    }
+}
+
+void motion_fire_column_at(uint16_t step, const uint8_t *frame) {
+    wait_for_firing_room(true);
+
+    // The interrupt does not read the slot at the head until it is queued
+    memcpy(columns[column_head], frame, sizeof(columns[0]));
+
+    MotionFiring firing;
+
+    firing.column = true;
+
+    if(!queue_firing(&firing, step, profile_column_addresses(frame))) {
+        fire_column(frame);
+    }
+}
+
+bool motion_moving(void) {
+    return active;
+}
+
+void motion_wait(void) {
+    motion_release();
+
+    while(motion_moving()) {
+        wait_idle();
+    }
+
+    x_axis.run();
+    y_axis.run();
+}
+
+uint16_t motion_ticks(void) {
+    uint8_t sreg = SREG;
+    cli();
+
+    uint16_t ticks = TCNT1;
+
+    SREG = sreg;
+
+    return ticks;
+}
+
+static void stop(void) {
+    TIMSK1 &= ~_BV(OCIE1A);
+    active = false;
+}
+
+// Abandon the running line and everything queued after it. Call with
+// interrupts off.
+static void discard_queue(void) {
+    x_axis.hold();
+    y_axis.hold();
+
+    firing_behind = false;
+
+    block_tail = block_head;
+    firing_tail = firing_head;
+    column_tail = column_head;
+    discard_count++;
+
+    stop();
+}
+
+void motion_abort(void) {
+    // A held line was never handed over, so dropping it is enough
+    hold_next = false;
+    holding = false;
+    same_step_ticks = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        discard_queue();
+    }
+}
+
+// Fire what is due on the running block by this step, up to the first column.
+// A firing queued for a step that has already passed goes on the next one.
+// Returns true if more are due.
+static inline bool fire_due(void) {
+    while(firing_tail != firing_head) {
+        MotionFiring *firing = &firings[firing_tail];
+
+        if(firing->block != block_tail || firing->step > step_count) {
+            return false;
+        }
+
+        firing_tail = next_firing_index(firing_tail);
+
+        if(firing->column) {
+            fire_column(columns[column_tail]);
+
+            column_tail = next_column_index(column_tail);
+
+            firing = &firings[firing_tail];
+
+            return firing_tail != firing_head
+                    && firing->block == block_tail
+                    && firing->step <= step_count;
+        }
+
+        fire_head(firing->r_prim, firing->r_addr,
+                  firing->l_prim, firing->l_addr);
+    }
+
+    return false;
+}
+
+// Set the match for the next step. Firing can keep the interrupt busy past the
+// time that was due, and a match set behind the counter would only come round
+// once it wraps, so a late step is taken as soon as possible instead.
+static inline void schedule_step(uint16_t interval) {
+    uint16_t elapsed = TCNT1 - OCR1A;
+
+    if((uint32_t)elapsed + MOTION_START_TICKS >= interval) {
+        OCR1A = TCNT1 + MOTION_START_TICKS;
+    } else {
+        OCR1A += interval;
+    }
+}
+
+// Move along the speed profile using the time spent on the previous step, and
+// return the delay until the next one.
+static uint16_t ramp(void) {
+    if(step_count < block->profile.accelerate_until) {
+        uint32_t nominal_rate = (uint32_t)block->profile.nominal_rate << 16;
+
+        step_rate += block->acceleration * step_interval;
+
+        if(step_rate > nominal_rate) {
+            step_rate = nominal_rate;
+        }
+    } else if(step_count >= block->profile.decelerate_after) {
+        uint32_t final_rate = (uint32_t)block->profile.final_rate << 16;
+        uint32_t change = block->acceleration * step_interval;
+
+        if(step_rate > final_rate + change) {
+            step_rate -= change;
+        } else {
+            step_rate = final_rate;
+        }
+    }
+
+    step_interval = motion_interval(step_rate >> 16);
+
+    return step_interval;
+}
+
+// Retire the line once its last step is taken, and set the match for the
+// next step.
+static inline void finish_step(void) {
+    if(step_count == block->step_events) {
+        block_tail = next_block_index(block_tail);
+
+        if(block_tail == block_head) {
+            stop();
+            return;
+        }
+
+        load_block();
+
+        schedule_step(step_interval);
+        return;
+    }
+
+    schedule_step(ramp());
+}
+
+// Fire the next column left over from the last step, and only carry on to the
+// next step once they're all gone.
+static inline void fire_behind(void) {
+    firing_behind = fire_due();
+
+    if(firing_behind) {
+        OCR1A = TCNT1 + PROFILE_FIRING_GAP_TICKS;
+        return;
+    }
+
+    OCR1A = behind_match;
+
+    finish_step();
+}
+
+ISR(TIMER1_COMPA_vect) {
+    if(firing_behind) {
+        fire_behind();
+        return;
+    }
+
+    bool stepped = true;
+
+    // Sampled once for both axes, so a switch stops motion within one step
+    // whatever the foreground is doing
+    uint8_t switches = limit_read();
+
+    x_error += block->x_steps;
+
+    if(x_error > 0) {
+        x_error -= block->step_events;
+        stepped = x_axis.interrupt_step(switches);
+    }
+
+    y_error += block->y_steps;
+
+    if(stepped && y_error > 0) {
+        y_error -= block->step_events;
+        stepped = y_axis.interrupt_step(switches);
+    }
+
+    // A limit switch was hit, abandon this line and everything queued after
+    // it.
+    if(!stepped) {
+        discard_queue();
+        return;
+    }
+
+    step_count++;
+
+    firing_behind = fire_due();
+
+    if(firing_behind) {
+        behind_match = OCR1A;
+        OCR1A = TCNT1 + PROFILE_FIRING_GAP_TICKS;
+        return;
+    }
+
+    finish_step();
+}
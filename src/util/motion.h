@@ -0,0 +1,98 @@
+#ifndef _MOTION_H_
+#define _MOTION_H_
+
+#include <Arduino.h>
+
+// Timer 1 free-runs with a prescaler of 8, giving a 0.5 microsecond tick. Both
+// axes are stepped together from the output compare A interrupt, which
+// schedules its own next match.
+//
+// Timer 1 is no longer available for PWM, so AOUT 2 and 3 (pins 11 and 12)
+// cannot be used with analogWrite(). Compare B triggers the background sample
+// of the primitive voltage once per timer period (see utils.h).
+#define MOTION_TICKS_PER_SECOND (F_CPU / 8)
+
+// The first step of a move is scheduled at least this far in the future, so
+// the compare match cannot be missed while it is being set up.
+#define MOTION_START_TICKS 16
+
+void motion_initialise(void);
+
+// Delay between steps at the given rate in steps per second, in timer ticks.
+// Rates below ~31 steps per second are clamped to the longest interval. From
+// MOTION_TABLE_FIRST_RATE upwards the interval is interpolated from a table
+// rather than divided out, so it is cheap enough to call for every step.
+uint16_t motion_interval(uint16_t steps_per_second);
+
+// The interval table starts here and has an entry every MOTION_TABLE_STEP
+// steps per second. Faster rates are clamped to the last entry.
+#define MOTION_TABLE_FIRST_RATE 256
+#define MOTION_TABLE_STEP 32
+#define MOTION_TABLE_SIZE 257
+#define MOTION_TABLE_LAST_RATE \
+    (MOTION_TABLE_FIRST_RATE + (MOTION_TABLE_SIZE - 1) * MOTION_TABLE_STEP - 1)
+
+// Number of lines that can be queued ahead of the one running. Must be a power
+// of two.
+#define MOTION_BUFFER_SIZE 16
+
+// Queue a straight line move of both axes to an absolute position in steps.
+// The path speed is that of the slower of the moving axes. Only waits if the
+// queue is full.
+void motion_move_to(uint32_t x, uint32_t y);
+
+// The next line queued is held back from the interrupt until released, so
+// that firings can be attached to it before the carriage can reach them. A
+// held line is released by the next motion_move_to() or motion_wait(), or once
+// the firing queue is full.
+void motion_hold(void);
+void motion_release(void);
+
+// Number of head firings that can be waiting on queued lines. Must be a power
+// of two.
+#define MOTION_FIRING_BUFFER_SIZE 64
+
+// Fire the head as the carriage passes a step of the last queued line, or the
+// held one, from 1 up to the line's length in steps of the major axis. Firings
+// on a line must be queued in step order. If nothing is queued the head fires straight away.
+// Only waits if the firing queue is full.
+void motion_fire_at(uint16_t step, uint8_t r_prim, uint8_t r_addr,
+                    uint8_t l_prim, uint8_t l_addr);
+
+// Fire the head once the carriage reaches the end of the last queued line.
+inline void motion_fire(uint8_t r_prim, uint8_t r_addr,
+                        uint8_t l_prim, uint8_t l_addr) {
+    motion_fire_at(0xFFFF, r_prim, r_addr, l_prim, l_addr);
+}
+
+// Number of column frames that can be waiting, out of the firing queue. Must
+// be a power of two.
+#define MOTION_COLUMN_BUFFER_SIZE 8
+
+// As motion_fire_at(), for a whole column frame of FIRING_ADDRESSES groups of
+// address, right primitives and left primitives. The frame is copied.
+void motion_fire_column_at(uint16_t step, const uint8_t *frame);
+
+inline void motion_fire_column(const uint8_t *frame) {
+    motion_fire_column_at(0xFFFF, frame);
+}
+
+// True while there are lines queued or running.
+bool motion_moving(void);
+
+// Wait for every queued line to finish.
+void motion_wait(void);
+
+// Stop straight away, as if a limit switch had been hit, and throw away every
+// queued line and firing. The axes are left where they stopped.
+void motion_abort(void);
+
+// Called over and over whenever the foreground has to wait on the motion
+// queue, so that work such as reading ahead on the SD card overlaps with the
+// moves. NULL for none.
+void motion_set_idle(void (*idle)(void));
+
+// Read the free-running motion timer.
+uint16_t motion_ticks(void);
+
+#endif
@@ -0,0 +1,106 @@
+#include <math.h>
+#include "decb.h"
+#include "profile.h"
+
+float profile_rest_speed_sqr(float acceleration)
+{
+    return 2.0 * acceleration;
+}
+
+void profile_trapezoid(float length, float acceleration, float entry_sqr,
+                       float exit_sqr, float nominal_sqr,
+                       float *accelerate, float *decelerate)
+{
+    if (entry_sqr > nominal_sqr)
+        entry_sqr = nominal_sqr;
+    if (exit_sqr > nominal_sqr)
+        exit_sqr = nominal_sqr;
+
+    *accelerate = (nominal_sqr - entry_sqr) / (2.0 * acceleration);
+    *decelerate = (nominal_sqr - exit_sqr) / (2.0 * acceleration);
+
+    if (*accelerate + *decelerate <= length)
+        return;
+
+    *accelerate = (2.0 * acceleration * length + exit_sqr - entry_sqr) /
+                  (4.0 * acceleration);
+
+    if (*accelerate < 0)
+        *accelerate = 0;
+    if (*accelerate > length)
+        *accelerate = length;
+
+    *decelerate = length - *accelerate;
+}
+
+float profile_seconds(float length, float acceleration, float entry_sqr,
+                      float exit_sqr, float nominal_sqr)
+{
+    float accelerate, decelerate;
+
+    if (acceleration <= 0)
+        return length / sqrt(nominal_sqr);
+
+    if (entry_sqr > nominal_sqr)
+        entry_sqr = nominal_sqr;
+    if (exit_sqr > nominal_sqr)
+        exit_sqr = nominal_sqr;
+
+    profile_trapezoid(length, acceleration, entry_sqr, exit_sqr, nominal_sqr,
+                      &accelerate, &decelerate);
+
+    float entry = sqrt(entry_sqr);
+    float exit = sqrt(exit_sqr);
+    float peak = sqrt(entry_sqr + 2.0 * acceleration * accelerate);
+    float cruise = length - accelerate - decelerate;
+
+    float seconds = (peak - entry) / acceleration +
+                    (peak - exit) / acceleration;
+
+    if (cruise > 0)
+        seconds += cruise / peak;
+
+    return seconds;
+}
+
+// Each phase waits a tick past its length, and setting the ports up takes
+// about another.
+uint16_t profile_address_ticks(uint8_t hold_ticks, uint8_t pulse_ticks)
+{
+    return (uint16_t)hold_ticks * 2 + pulse_ticks + 4;
+}
+
+uint8_t profile_column_addresses(const uint8_t *frame)
+{
+    uint8_t addresses = 0;
+    uint8_t i;
+
+    for (i = 0; i < FIRING_ADDRESSES; i++, frame += 3)
+        if (frame[1] || frame[2])
+            addresses++;
+
+    return addresses;
+}
+
+uint32_t profile_firing_ticks(uint16_t address_ticks, uint8_t addresses,
+                              uint8_t column)
+{
+    uint32_t ticks = (uint32_t)address_ticks * addresses * 3 / 2;
+
+    if (column)
+        ticks += PROFILE_FIRING_GAP_TICKS + PROFILE_STEP_TICKS;
+
+    return ticks;
+}
+
+uint16_t profile_firing_rate(uint32_t ticks)
+{
+    uint32_t rate = PROFILE_TICKS_PER_SECOND / ticks;
+
+    if (rate < 1)
+        return 1;
+    if (rate > 0xFFFF)
+        return 0xFFFF;
+
+    return rate;
+}
@@ -0,0 +1,55 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+
+// Speed profile and firing time sums shared by the motion planner and the job
+// estimate, so that an estimate works a print out the way it will be run.
+// Speeds are along the path in steps per second, and are squared wherever the
+// planner compares them so that it needs no square roots.
+
+// Motion timer 1 ticks, half a microsecond with F_CPU at 16 MHz.
+#define PROFILE_TICKS_PER_SECOND 2000000UL
+
+// Time the step interrupt takes besides firing, in timer ticks.
+#define PROFILE_STEP_TICKS 64
+
+// Gap left between the passes of the step interrupt that fire what is due
+// after a column, in timer ticks.
+#define PROFILE_FIRING_GAP_TICKS 40
+
+// Lines start from, and come to a stop at, the speed reached after a single
+// step from rest.
+float profile_rest_speed_sqr(float acceleration);
+
+// Distances a line of the given length spends accelerating from its entry
+// speed and decelerating to its exit speed. Lines too short to reach the
+// nominal speed accelerate up to the point where they need to start
+// decelerating.
+void profile_trapezoid(float length, float acceleration, float entry_sqr,
+                       float exit_sqr, float nominal_sqr,
+                       float *accelerate, float *decelerate);
+
+// Seconds a line takes along that profile. Without acceleration it runs at
+// the nominal speed throughout.
+float profile_seconds(float length, float acceleration, float entry_sqr,
+                      float exit_sqr, float nominal_sqr);
+
+// Time fire_head(), or each address in use in a column, takes with the given
+// address hold and pulse width, in timer ticks.
+uint16_t profile_address_ticks(uint8_t hold_ticks, uint8_t pulse_ticks);
+
+// Number of addresses with primitives to fire in a column frame.
+uint8_t profile_column_addresses(const uint8_t *frame);
+
+// Time a firing adds to the step it is due on, in timer ticks. Each address
+// is allowed half as long again for voltage compensation, and anything due
+// after a column waits for a pass of its own.
+uint32_t profile_firing_ticks(uint16_t address_ticks, uint8_t addresses,
+                              uint8_t column);
+
+// Fastest major axis rate, in steps per second, that leaves the given ticks
+// for each step. Add PROFILE_STEP_TICKS to the firing ticks.
+uint16_t profile_firing_rate(uint32_t ticks);
+
+#endif
@@ -1,9 +1,11 @@
 #include "settings.h"
 
 #include <EEPROM.h>
+#include <stddef.h>
 #include "utils.h"
 
 PrinterSettings default_settings = {
+    SETTINGS_VERSION,
     {
         {
             'B',
@@ -26,17 +28,91 @@ PrinterSettings default_settings = {
         70,
         80
     },
+    {
+        400
+    },
+    {
+        500,
+        6500
+    },
     0x23
 };
 
 PrinterSettings global_settings;
 
+// Earlier firmware saved PrinterSettings without a version and without the
+// blocks that have since been added to the end, with its CRC straight after
+// the last field it had.
+#define LEGACY_SETTINGS_SIZE(field) \
+    (offsetof(PrinterSettings, field) - offsetof(PrinterSettings, calibration))
+
+static const uint16_t legacy_settings_sizes[] = {
+    LEGACY_SETTINGS_SIZE(motionOptions),
+    LEGACY_SETTINGS_SIZE(cartridgeOptions),
+    LEGACY_SETTINGS_SIZE(crc)
+};
+
+// A CRC8 alone passes for the wrong layout one time in 256, so the saved
+// values have to look like settings as well.
+static bool settings_plausible(PrinterSettings *settings) {
+    uint8_t x_motor = settings->calibration.x_axis.motor;
+    uint8_t y_motor = settings->calibration.y_axis.motor;
+
+    return (x_motor == 'A' || x_motor == 'B') &&
+           (y_motor == 'A' || y_motor == 'B') &&
+           x_motor != y_motor &&
+           memchr(settings->printerNumber, '\0',
+                  sizeof(settings->printerNumber)) != NULL;
+}
+
+// Keep what an older layout saved and take defaults for the rest, so a
+// firmware update doesn't lose the calibration or printer number. Layouts
+// only ever grew, so if more than one fits the shortest is used: whichever
+// was saved, the fields it keeps hold the same values.
+static bool settings_migrate(void) {
+    uint8_t saved[sizeof(PrinterSettings)];
+
+    read_block(SETTINGS_ADDRESS, saved, sizeof(saved));
+
+    for(uint8_t i = 0; i < sizeof(legacy_settings_sizes) / sizeof(uint16_t); i++) {
+        uint16_t size = legacy_settings_sizes[i];
+        PrinterSettings migrated;
+
+        if(CRC8(saved, size) != saved[size]) {
+            continue;
+        }
+
+        memcpy(&migrated, &default_settings, sizeof(PrinterSettings));
+        memcpy(&migrated.calibration, saved, size);
+
+        if(!settings_plausible(&migrated)) {
+            continue;
+        }
+
+        memcpy(&global_settings, &migrated, sizeof(PrinterSettings));
+        settings_write_settings(&global_settings);
+
+        Serial.println("Settings migrated from an older layout.");
+
+        return true;
+    }
+
+    return false;
+}
+
 // Settings helpers
 
 bool settings_initialise() {
     settings_read_settings(&global_settings);
 
-    bool valid = settings_integrity_check(&global_settings);
+    // Versioned settings are never migrated, only unversioned ones
+    bool valid;
+
+    if(global_settings.version == SETTINGS_VERSION) {
+        valid = settings_integrity_check(&global_settings);
+    } else {
+        valid = settings_migrate();
+    }
 
     if (!valid) {
         Serial.println("Settings corrupt.");
@@ -56,6 +132,8 @@ void settings_print_settings(PrinterSettings *settings) {
     settings_print_processing_options(&(settings->processingOptions));
     settings_print_printer_number(settings->printerNumber);
     settings_print_roller_options(&(settings->rollerOptions));
+    settings_print_motion_options(&(settings->motionOptions));
+    settings_print_cartridge_options(&(settings->cartridgeOptions));
 
     uint8_t crc = settings_calculate_crc(settings);
 
@@ -130,6 +208,20 @@ void settings_print_roller_options(RollerOptionsData *rollerOptions)
     Serial.println(rollerOptions->deployed_pos);
 }
 
+void settings_print_motion_options(MotionOptionsData *motionOptions)
+{
+    Serial.print("acceleration: ");
+    Serial.println(motionOptions->acceleration);
+}
+
+void settings_print_cartridge_options(CartridgeOptionsData *cartridgeOptions)
+{
+    Serial.print("address_hold: ");
+    Serial.println(cartridgeOptions->address_hold);
+    Serial.print("pulse_width: ");
+    Serial.println(cartridgeOptions->pulse_width);
+}
+
 // Settings CRC Utilities
 
 uint8_t settings_calculate_crc(PrinterSettings *settings) {
@@ -196,6 +288,193 @@ void settings_update_crc(void) {
     global_settings.crc = settings_calculate_crc(&global_settings);
 }
 
+// Print Checkpoint
+
+static uint16_t progress_address(uint8_t slot) {
+    return CHECKPOINT_PROGRESS_ADDRESS + slot * sizeof(CheckpointProgress);
+}
+
+static uint16_t decoder_address(uint8_t slot) {
+    return CHECKPOINT_DECODER_ADDRESS + slot * sizeof(CheckpointDecoder);
+}
+
+static bool read_pass(CheckpointPass *pass) {
+    read_block(CHECKPOINT_ADDRESS, pass, sizeof(CheckpointPass));
+
+    return CRC8(pass, sizeof(CheckpointPass) - sizeof(uint8_t)) == pass->crc;
+}
+
+static bool read_progress(uint8_t slot, CheckpointProgress *progress) {
+    read_block(progress_address(slot), progress, sizeof(CheckpointProgress));
+
+    return CRC8(progress, sizeof(CheckpointProgress) - sizeof(uint8_t))
+            == progress->crc && progress->decoder_slot < CHECKPOINT_SLOTS;
+}
+
+// Sequence numbers wrap, so only their difference counts.
+static bool newer(uint16_t sequence, uint16_t than) {
+    return (int16_t)(sequence - than) > 0;
+}
+
+// The newest good progress from at least first and older than before. False if
+// there is none.
+static bool find_progress(uint16_t first, uint16_t before, bool bounded,
+                          CheckpointProgress *found) {
+    CheckpointProgress progress;
+    bool any = false;
+
+    for(uint8_t slot = 0; slot < CHECKPOINT_SLOTS; slot++) {
+        if(!read_progress(slot, &progress) ||
+                newer(first, progress.sequence) ||
+                (bounded && !newer(before, progress.sequence))) {
+            continue;
+        }
+
+        if(!any || newer(progress.sequence, found->sequence)) {
+            memcpy(found, &progress, sizeof(progress));
+            any = true;
+        }
+    }
+
+    return any;
+}
+
+// A decoder slot only goes with the progress that names its sequence number.
+static bool decoder_matches(const CheckpointProgress *progress,
+                            CheckpointDecoder *decoder) {
+    read_block(decoder_address(progress->decoder_slot), decoder,
+               sizeof(CheckpointDecoder));
+
+    return CRC8(decoder, sizeof(CheckpointDecoder) - sizeof(uint8_t))
+            == decoder->crc && decoder->sequence == progress->decoder_sequence;
+}
+
+// Falls back to older progress if the newest was torn by a power cut.
+bool settings_read_checkpoint(CheckpointData *checkpoint) {
+    CheckpointPass pass;
+    CheckpointProgress progress;
+    CheckpointDecoder decoder;
+
+    if(!read_pass(&pass) || pass.filename[0] == 0) {
+        return false;
+    }
+
+    bool bounded = false;
+    uint16_t before = 0;
+
+    for(;;) {
+        if(!find_progress(pass.first_sequence, before, bounded, &progress)) {
+            return false;
+        }
+
+        if(decoder_matches(&progress, &decoder)) {
+            break;
+        }
+
+        before = progress.sequence;
+        bounded = true;
+    }
+
+    memcpy(checkpoint->filename, pass.filename, sizeof(pass.filename));
+    checkpoint->pass = pass.pass;
+    checkpoint->passes = pass.passes;
+    checkpoint->offset = progress.offset;
+    checkpoint->x_position = progress.x_position;
+    checkpoint->y_position = progress.y_position;
+    memcpy(&checkpoint->decoder, &decoder.decoder, sizeof(DecbState));
+
+    return true;
+}
+
+// The last progress and decoder state written, picked up from EEPROM by the
+// first save after a reset.
+static bool checkpoint_found = false;
+static CheckpointProgress last_progress;
+static uint8_t progress_slot;
+
+void settings_write_checkpoint(CheckpointData *checkpoint) {
+    if(!checkpoint_found) {
+        CheckpointProgress progress;
+        bool any = false;
+
+        for(uint8_t slot = 0; slot < CHECKPOINT_SLOTS; slot++) {
+            if(read_progress(slot, &progress) &&
+                    (!any || newer(progress.sequence, last_progress.sequence))) {
+                memcpy(&last_progress, &progress, sizeof(progress));
+                progress_slot = slot;
+                any = true;
+            }
+        }
+
+        if(!any) {
+            memset(&last_progress, 0, sizeof(last_progress));
+            progress_slot = CHECKPOINT_SLOTS - 1;
+        }
+
+        checkpoint_found = true;
+    }
+
+    uint16_t sequence = last_progress.sequence + 1;
+
+    // Only rewritten when a new pass starts
+    CheckpointPass pass;
+    bool same_pass = read_pass(&pass) &&
+            strncmp(pass.filename, checkpoint->filename,
+                    sizeof(pass.filename)) == 0 &&
+            pass.pass == checkpoint->pass && pass.passes == checkpoint->passes;
+
+    if(!same_pass) {
+        memcpy(pass.filename, checkpoint->filename, sizeof(pass.filename));
+        pass.pass = checkpoint->pass;
+        pass.passes = checkpoint->passes;
+        pass.first_sequence = sequence;
+        pass.crc = CRC8(&pass, sizeof(CheckpointPass) - sizeof(uint8_t));
+
+        write_block(CHECKPOINT_ADDRESS, &pass, sizeof(CheckpointPass));
+    }
+
+    // The decoder state only moves on to the next slot when it has changed
+    CheckpointDecoder decoder;
+    CheckpointProgress progress;
+
+    progress.decoder_slot = last_progress.decoder_slot;
+    progress.decoder_sequence = last_progress.decoder_sequence;
+
+    if(!decoder_matches(&last_progress, &decoder) ||
+            memcmp(&decoder.decoder, &checkpoint->decoder,
+                   sizeof(DecbState)) != 0) {
+        progress.decoder_slot = (last_progress.decoder_slot + 1)
+                % CHECKPOINT_SLOTS;
+        progress.decoder_sequence = sequence;
+
+        decoder.sequence = sequence;
+        memcpy(&decoder.decoder, &checkpoint->decoder, sizeof(DecbState));
+        decoder.crc = CRC8(&decoder,
+                           sizeof(CheckpointDecoder) - sizeof(uint8_t));
+
+        write_block(decoder_address(progress.decoder_slot), &decoder,
+                    sizeof(CheckpointDecoder));
+    }
+
+    progress.sequence = sequence;
+    progress.offset = checkpoint->offset;
+    progress.x_position = checkpoint->x_position;
+    progress.y_position = checkpoint->y_position;
+    progress.crc = CRC8(&progress,
+                        sizeof(CheckpointProgress) - sizeof(uint8_t));
+
+    progress_slot = (progress_slot + 1) % CHECKPOINT_SLOTS;
+
+    write_block(progress_address(progress_slot), &progress,
+                sizeof(CheckpointProgress));
+
+    memcpy(&last_progress, &progress, sizeof(progress));
+}
+
+void settings_clear_checkpoint(void) {
+    write_byte(CHECKPOINT_ADDRESS, 0, true);
+}
+
 // Base EEPROM Functions
 
 uint8_t read_byte(const uint16_t address) {
@@ -4,8 +4,25 @@
 
 #include <Arduino.h>
 
+extern "C" {
+#include "decb.h"
+}
+
 const uint16_t SETTINGS_ADDRESS = 0;
 
+// Bump whenever PrinterSettings changes. Settings saved before there was a
+// version start with the X motor letter instead, so this must never be 'A'
+// or 'B'.
+const uint8_t SETTINGS_VERSION = 1;
+
+// Print progress is kept well clear of the settings, so they can grow. The
+// print being run is followed by slots for its progress and decoder state,
+// which are written in turn to spread the wear.
+const uint16_t CHECKPOINT_ADDRESS = 1024;
+const uint16_t CHECKPOINT_PROGRESS_ADDRESS = 1088;
+const uint16_t CHECKPOINT_DECODER_ADDRESS = 1408;
+const uint8_t CHECKPOINT_SLOTS = 16;
+
 // Insist that our structs are 1-byte boundary aligned. (No padding)
 #pragma pack(push, 1)
 
@@ -31,11 +48,61 @@ struct RollerOptionsData {
     uint8_t deployed_pos;
 };
 
+struct MotionOptionsData {
+    uint16_t acceleration; // mm/s^2, 0 disables acceleration
+};
+
+// Printhead pulse timing, rounded to the 0.5 us motion timer tick
+struct CartridgeOptionsData {
+    uint16_t address_hold; // ns, t_h, address set before and after the pulse
+    uint16_t pulse_width;  // ns, t_pw, primitives on
+};
+
 struct PrinterSettings {
+    uint8_t version;
     CalibrationData calibration;
     ProcessingOptionsData processingOptions;
     char printerNumber[20];
     RollerOptionsData rollerOptions;
+    MotionOptionsData motionOptions;
+    CartridgeOptionsData cartridgeOptions;
+    uint8_t crc;
+};
+
+// Where a print from file had got to, so that it can be resumed.
+struct CheckpointData {
+    char filename[32];
+    uint32_t offset;     // First byte of the file not yet run
+    uint32_t x_position; // Steps, once everything before offset has run
+    uint32_t y_position;
+    uint8_t pass;        // From 0
+    uint8_t passes;
+    DecbState decoder;   // Only used for compressed files
+};
+
+// How a checkpoint is stored. Progress only counts from the sequence number
+// the pass started at, and names the decoder state it was saved with.
+struct CheckpointPass {
+    char filename[32];
+    uint8_t pass;
+    uint8_t passes;
+    uint16_t first_sequence;
+    uint8_t crc;
+};
+
+struct CheckpointProgress {
+    uint16_t sequence;
+    uint32_t offset;
+    uint32_t x_position;
+    uint32_t y_position;
+    uint16_t decoder_sequence;
+    uint8_t decoder_slot;
+    uint8_t crc;
+};
+
+struct CheckpointDecoder {
+    uint16_t sequence;
+    DecbState decoder;
     uint8_t crc;
 };
 
@@ -54,6 +121,8 @@ void settings_print_axis_data_minimal(AxisData *axis);
 void settings_print_processing_options(ProcessingOptionsData *processingOptions);
 void settings_print_printer_number(char *printerNumber);
 void settings_print_roller_options(RollerOptionsData *rollerOptions);
+void settings_print_motion_options(MotionOptionsData *motionOptions);
+void settings_print_cartridge_options(CartridgeOptionsData *cartridgeOptions);
 
 uint8_t settings_calculate_crc(PrinterSettings *settings);
 bool settings_integrity_check(PrinterSettings *settings);
@@ -67,6 +136,14 @@ void settings_update_x_data(AxisData *axis_data);
 void settings_update_y_data(AxisData *axis_data);
 void settings_update_crc(void);
 
+// False if there is no print to resume.
+bool settings_read_checkpoint(CheckpointData *checkpoint);
+
+// Progress goes to the next slot each time. The decoder state is only written
+// when it differs from the last saved.
+void settings_write_checkpoint(CheckpointData *checkpoint);
+void settings_clear_checkpoint(void);
+
 uint8_t read_byte(uint16_t address);
 void write_byte(const uint16_t address, const uint8_t value, bool reduce_wear);
 
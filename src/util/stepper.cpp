@@ -30,16 +30,25 @@ Author: Michael Shiel
 
 #include "logging.h"
 
+#include <util/atomic.h>
+
 Stepper::Stepper(int step_pin, int dir_pin, int enable_pin) {
     this->step_pin = step_pin;
     this->dir_pin = dir_pin;
     this->enable_pin = enable_pin;
 
+    step_port = portOutputRegister(digitalPinToPort(step_pin));
+    dir_port = portOutputRegister(digitalPinToPort(dir_pin));
+    enable_port = portOutputRegister(digitalPinToPort(enable_pin));
+
+    step_mask = digitalPinToBitMask(step_pin);
+    dir_mask = digitalPinToBitMask(dir_pin);
+    enable_mask = digitalPinToBitMask(enable_pin);
+
     this->last_step_time = 0;
 
     /* Speed is the delay between steps necessary to move at the required speed
-     * The default speed is 500. To move instantaneously, set speed to 0 (this
-     * will cause the motors to skip). Speed is not used by functions which step
+     * The default speed is 500. Speed is not used by functions which step
      * only once.
      */
     set_speed(500);
@@ -55,11 +64,15 @@ Stepper::Stepper(int step_pin, int dir_pin, int enable_pin) {
     enable(true);
 }
 
+// The step interrupt writes to the same ports, so the read-modify-writes here
+// have to be atomic.
 void Stepper::enable(bool enabled) {
-    if (enabled) {
-        digitalWrite(enable_pin, LOW);
-    } else {
-        digitalWrite(enable_pin, HIGH);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (enabled) {
+            *enable_port &= ~enable_mask;
+        } else {
+            *enable_port |= enable_mask;
+        }
     }
 }
 
@@ -72,10 +85,12 @@ uint8_t Stepper::swap_direction(void) {
 void Stepper::set_direction(uint8_t direction) {
     this->direction = direction;
 
-    if (direction) {
-        digitalWrite(dir_pin, HIGH);
-    } else {
-        digitalWrite(dir_pin, LOW);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (direction) {
+            *dir_port |= dir_mask;
+        } else {
+            *dir_port &= ~dir_mask;
+        }
     }
 }
 
@@ -85,8 +100,7 @@ uint8_t Stepper::get_direction(void) {
 
 bool Stepper::step() {
     if((micros() - last_step_time) > step_delay) {
-        digitalWrite(step_pin, HIGH);
-        digitalWrite(step_pin, LOW);
+        pulse();
 
         last_step_time = micros();
 
@@ -101,15 +115,32 @@ void Stepper::set_speed(int mm_per_minute) {
 
     if (rate > 5000) {
         rate = 5000; //maximum rate
-    } else if (rate < 0) {
-        rate = 0; // cannot have a negative rate
+    } else if (rate < 1) {
+        rate = 1; // cannot have a zero or negative rate
+    }
+
+    speed = rate;
+
+    long steps_per_second = (rate * steps_per_mm) / 60;
+
+    if (steps_per_second < 1) {
+        steps_per_second = 1;
     }
 
-    long i = 1000000/((rate * steps_per_mm)/60);
+    step_rate = steps_per_second;
 
-    step_delay = i;
+    // The motion timer only holds 16 bits, which limits the slowest rate the
+    // step interrupt can produce to ~23 mm/min.
+    uint16_t step_interval = motion_interval(steps_per_second);
+
+    // Timer ticks are half a microsecond, only the slowest rates need dividing
+    if (step_interval < 0xFFFF) {
+        step_delay = step_interval >> 1;
+    } else {
+        step_delay = 1000000 / steps_per_second;
+    }
 }
 
 int Stepper::get_speed() {
-    return 0; //speed;
+    return speed;
 }
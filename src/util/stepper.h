@@ -30,6 +30,12 @@ Author: Michael Shiel
 #define _STEPPER_H_
 
 #include "Arduino.h"
+#include "motion.h"
+
+#include <util/delay.h>
+
+// Minimum high time of a step pulse for the motor drivers
+#define STEPPER_PULSE_MICROSECONDS 2
 
 class Stepper {
 public:
@@ -48,9 +54,23 @@ public:
 
     bool step();
 
-    void set_speed(int mm_per_minute); //set to 0 for instantaneous movement
+    // Issue a single step pulse immediately. Used by the step interrupt, which
+    // does its own timing. Writes the port directly, the driver only needs the
+    // pin held high for a couple of microseconds.
+    inline void pulse(void) {
+        *step_port |= step_mask;
+        _delay_us(STEPPER_PULSE_MICROSECONDS);
+        *step_port &= ~step_mask;
+    }
+
+    void set_speed(int mm_per_minute);
     int  get_speed();
 
+    // Current speed in steps per second.
+    inline uint16_t get_step_rate(void) {
+        return step_rate;
+    }
+
     static const long steps_per_mm = 80;
 
 private:
@@ -58,9 +78,21 @@ private:
     int dir_pin;
     int enable_pin;
 
+    // Output registers and bit masks of the pins above, looked up once so
+    // that the hot paths do not go through digitalWrite().
+    volatile uint8_t *step_port;
+    volatile uint8_t *dir_port;
+    volatile uint8_t *enable_port;
+
+    uint8_t step_mask;
+    uint8_t dir_mask;
+    uint8_t enable_mask;
+
     long last_step_time;
     int direction;
-    int step_delay;
+    long step_delay;
+    int speed;
+    uint16_t step_rate;
 };
 
 #endif
@@ -6,6 +6,18 @@
 
 #include "../argentum/argentum.h"
 
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+// Readings of 9 V and 6 V through the 1/3 divider. Below the minimum the rail
+// is taken to be switched off, rather than sagging.
+#define PRIMITIVE_NOMINAL_READING 614
+#define PRIMITIVE_MINIMUM_READING 410
+
+static bool primitive_background = false;
+static volatile uint16_t primitive_reading = 0;
+static volatile uint16_t pulse_scale = 256;
+
 int ram_used(void) {
   extern int __heap_start, *__brkval;
   int v;
@@ -115,12 +127,91 @@ void analog_initialise(void) {
     pinMode(PIN_PRIMITIVE_VOLTAGE, INPUT);
 }
 
+// ADC15, the primitive voltage, against AVcc
+static void select_primitive_channel(void) {
+    ADMUX = _BV(REFS0) | 0x07;
+    ADCSRB |= _BV(MUX5);
+}
+
 uint16_t analog_read(uint8_t analog) {
-    return analogRead(analog);
+    if(!primitive_background) {
+        return analogRead(analog);
+    }
+
+    // Hold off the background sampling while the channel is borrowed
+    ADCSRA &= ~(_BV(ADATE) | _BV(ADIE));
+
+    while(ADCSRA & _BV(ADSC));
+
+    uint16_t value = analogRead(analog);
+
+    // Drop the borrowed result and re-arm the trigger
+    select_primitive_channel();
+    TIFR1 = _BV(OCF1B);
+    ADCSRA |= _BV(ADIF) | _BV(ADATE) | _BV(ADIE);
+
+    return value;
+}
+
+void primitive_voltage_start(void) {
+    select_primitive_channel();
+
+    // Auto trigger on timer 1 compare B
+    ADCSRB = (ADCSRB & ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0)))
+            | _BV(ADTS2) | _BV(ADTS0);
+    OCR1B = 0;
+    TIFR1 = _BV(OCF1B);
+
+    ADCSRA |= _BV(ADIF) | _BV(ADATE) | _BV(ADIE);
+
+    primitive_background = true;
+}
+
+ISR(ADC_vect) {
+    uint16_t reading = ADC;
+
+    // A new conversion is only triggered once the compare flag is cleared
+    TIFR1 = _BV(OCF1B);
+
+    primitive_reading = reading;
+
+    if(reading < PRIMITIVE_MINIMUM_READING) {
+        pulse_scale = 256;
+        return;
+    }
+
+    uint32_t ratio = ((uint32_t)PRIMITIVE_NOMINAL_READING << 8) / reading;
+
+    // Never more than half again, or less than half, the set pulse width
+    pulse_scale = constrain((ratio * ratio) >> 8, 128, 384);
+}
+
+uint16_t primitive_voltage_reading(void) {
+    uint16_t reading;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        reading = primitive_reading;
+    }
+
+    return reading;
+}
+
+uint16_t primitive_pulse_scale(void) {
+    uint16_t scale;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        scale = pulse_scale;
+    }
+
+    return scale;
 }
 
 double primitive_voltage(void) {
-    uint16_t adc_reading = analog_read(PIN_PRIMITIVE_VOLTAGE);
+    uint16_t adc_reading = primitive_voltage_reading();
+
+    if(adc_reading == 0) {
+        adc_reading = analog_read(PIN_PRIMITIVE_VOLTAGE);
+    }
 
     // Hardware voltage divider of 1/3
     double voltage = (adc_reading / 1024.0) * 5.0 * 3.0;
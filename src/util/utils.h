@@ -23,4 +23,16 @@ uint16_t analog_read(uint8_t analog);
 
 double primitive_voltage(void);
 
+// Sample the primitive rail in the background, once per motion timer period
+// (~33 ms), with conversions triggered by timer 1 compare B.
+void primitive_voltage_start(void);
+
+// Latest background sample in ADC counts, 0 before the first one.
+uint16_t primitive_voltage_reading(void);
+
+// How much to scale the pulse width by, as 8.8 fixed point, so that the
+// primitives get the energy of a pulse at the nominal 9 V. Energy goes with the
+// square of the voltage. 1.0 until the rail has been sampled, or if it is off.
+uint16_t primitive_pulse_scale(void);
+
 #endif